@@ -4,6 +4,47 @@
 #include <string>
 #include <cmath>
 #include <vector>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include <deque>
+#include <unordered_map>
+#include <unordered_set>
+#include <condition_variable>
+#include <functional>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define HAVE_MMAP 1
+#endif
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <cerrno>
+#define HAVE_EPOLL 1
+#endif
 
 // Constants for the board size and number of pieces
 const int BOARD_SIZE = 24;
@@ -19,31 +60,340 @@ std::ostream& operator<<(std::ostream& stream, const Player& currentPlayer)
     return stream;
 }
 
+// Reasons a move can be rejected, the console turns them into messages for the player
+enum class MoveError
+{
+    NONE,
+    MUST_MOVE_FROM_BAR,
+    NOTHING_ON_BAR,
+    CANNOT_BEAR_OFF,
+    BAR_BLOCKED,
+    BEAR_OFF_TOO_FAR,
+    BEAR_OFF_HIGHER_PIECES,
+    BLOCKED
+};
+
+const int NUM_MOVE_ERRORS = 8;
+
+// Instrumentation of the rules engine, compiled in with -DENABLE_METRICS and left out completely otherwise.
+// Each thread counts into its own block, so recording never waits on other threads: the owning thread is the only
+// writer of its counters and a snapshot adds up every block with plain atomic loads. Blocks go on a lock-free list
+// the first time a thread records something and stay there, so the counts of finished threads are kept
+#ifdef ENABLE_METRICS
+enum class Metric { VALIDATE_MOVE, ROLL_DICE, ADJUST_DICE, GENERATE_PLAYS, EVALUATE, EVALUATE_BATCH };
+
+const int NUM_METRICS = 6;
+const char* const METRIC_NAMES[NUM_METRICS] = { "validate_move", "roll_dice", "adjust_dice", "generate_plays", "evaluate", "evaluate_batch" };
+
+// Operations that only take a few nanoseconds are counted without timing, reading the clock would cost more than the call
+const bool METRIC_TIMED[NUM_METRICS] = { false, false, true, true, true, true };
+
+const char* const MOVE_ERROR_NAMES[NUM_MOVE_ERRORS] = { "valid", "must_move_from_bar", "nothing_on_bar", "cannot_bear_off",
+    "bar_blocked", "bear_off_too_far", "bear_off_higher_pieces", "blocked" };
+
+// Latencies are kept in powers of two of nanoseconds, bucket k holds calls that took less than 2^(k+1) ns
+const int LATENCY_BUCKETS = 32;
+
+struct MetricsSnapshot
+{
+    uint64_t calls[NUM_METRICS] = {};
+    uint64_t nanoseconds[NUM_METRICS] = {};
+    uint64_t latency[NUM_METRICS][LATENCY_BUCKETS] = {};
+    uint64_t moveChecks[NUM_MOVE_ERRORS] = {};
+};
+
+class Metrics
+{
+public:
+    static void count(Metric metric)
+    {
+        Block& block = local();
+        add(block.calls[(int)metric], 1);
+    }
+
+    static void time(Metric metric, uint64_t nanoseconds)
+    {
+        Block& block = local();
+        int bucket = 0;
+        while (bucket < LATENCY_BUCKETS - 1 && (nanoseconds >> (bucket + 1)) != 0)
+            bucket++;
+        add(block.calls[(int)metric], 1);
+        add(block.nanoseconds[(int)metric], nanoseconds);
+        add(block.latency[(int)metric][bucket], 1);
+    }
+
+    static void moveCheck(MoveError error)
+    {
+        Block& block = local();
+        add(block.calls[(int)Metric::VALIDATE_MOVE], 1);
+        add(block.moveChecks[(int)error], 1);
+    }
+
+    // Adds up the blocks of every thread, while they may still be counting
+    static MetricsSnapshot snapshot()
+    {
+        MetricsSnapshot total;
+        for (Block* block = head().load(std::memory_order_acquire); block; block = block->next)
+        {
+            for (int m = 0; m < NUM_METRICS; m++)
+            {
+                total.calls[m] += block->calls[m].load(std::memory_order_relaxed);
+                total.nanoseconds[m] += block->nanoseconds[m].load(std::memory_order_relaxed);
+                for (int b = 0; b < LATENCY_BUCKETS; b++)
+                    total.latency[m][b] += block->latency[m][b].load(std::memory_order_relaxed);
+            }
+            for (int e = 0; e < NUM_MOVE_ERRORS; e++)
+                total.moveChecks[e] += block->moveChecks[e].load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+private:
+    struct Block
+    {
+        std::atomic<uint64_t> calls[NUM_METRICS] = {};
+        std::atomic<uint64_t> nanoseconds[NUM_METRICS] = {};
+        std::atomic<uint64_t> latency[NUM_METRICS][LATENCY_BUCKETS] = {};
+        std::atomic<uint64_t> moveChecks[NUM_MOVE_ERRORS] = {};
+        Block* next = nullptr;
+    };
+
+    // Only the owning thread writes a counter, so it needs no read-modify-write instruction
+    static void add(std::atomic<uint64_t>& counter, uint64_t value)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    static std::atomic<Block*>& head()
+    {
+        static std::atomic<Block*> blocks(nullptr);
+        return blocks;
+    }
+
+    static Block& local()
+    {
+        static thread_local Block* block = nullptr;
+        if (!block)
+        {
+            block = new Block();
+            block->next = head().load(std::memory_order_relaxed);
+            while (!head().compare_exchange_weak(block->next, block, std::memory_order_release, std::memory_order_relaxed))
+                ;
+        }
+        return *block;
+    }
+};
+
+// Times the rest of the scope it is declared in
+struct MetricTimer
+{
+    Metric metric;
+    std::chrono::steady_clock::time_point start;
+
+    explicit MetricTimer(Metric metric)
+        : metric(metric), start(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~MetricTimer()
+    {
+        Metrics::time(metric, (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+};
+
+#define METRIC_TIME(metric) MetricTimer metricTimer(metric)
+#define METRIC_COUNT(metric) Metrics::count(metric)
+#define METRIC_MOVE_CHECK(error) Metrics::moveCheck(error)
+#else
+#define METRIC_TIME(metric)
+#define METRIC_COUNT(metric)
+#define METRIC_MOVE_CHECK(error)
+#endif
+
+// Fast random number generator (xoshiro256**), seeded through splitmix64. Separate streams of one seed, such as one per
+// game of a batch, are seeded from streamSeed. It can be used with the standard distributions and std::shuffle
+struct Xoshiro256
+{
+    typedef uint64_t result_type;
+
+    uint64_t s[4];
+
+    explicit Xoshiro256(uint64_t value = 1)
+    {
+        seed(value);
+    }
+
+    // Stream number "stream" of a seed, such as the stream for one game of a batch
+    Xoshiro256(uint64_t value, uint64_t stream)
+    {
+        seed(streamSeed(value, stream));
+    }
+
+    void seed(uint64_t value)
+    {
+        for (uint64_t& word : s)
+            word = splitMix(value);
+    }
+
+    uint64_t operator()()
+    {
+        uint64_t result = rotate(s[1] * 5, 7) * 9;
+        uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotate(s[3], 45);
+        return result;
+    }
+
+    // Returns a number from 0 to n - 1 with equal chance, the few values that would favor the low numbers are rolled again
+    uint32_t below(uint32_t n)
+    {
+        uint64_t product = (uint64_t)(uint32_t)((*this)() >> 32) * n;
+        if ((uint32_t)product < n)
+        {
+            uint32_t threshold = (0u - n) % n;
+            while ((uint32_t)product < threshold)
+                product = (uint64_t)(uint32_t)((*this)() >> 32) * n;
+        }
+        return (uint32_t)(product >> 32);
+    }
+
+    // Returns the seed for stream number "stream" of a seed, nearby seeds and streams give unrelated results
+    static uint64_t streamSeed(uint64_t value, uint64_t stream)
+    {
+        uint64_t mixed = stream;
+        return value ^ splitMix(mixed);
+    }
+
+    static constexpr uint64_t min()
+    {
+        return 0;
+    }
+
+    static constexpr uint64_t max()
+    {
+        return UINT64_MAX;
+    }
+
+    static uint64_t rotate(uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    // Steps a splitmix64 generator and returns its next number
+    static uint64_t splitMix(uint64_t& state)
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+};
+
+// Interface for where the dice come from
+struct DiceSource
+{
+    virtual ~DiceSource() {}
+
+    // Returns the next die, 1 to 6
+    virtual int nextDie() = 0;
+};
+
+// Dice from a seeded random stream, the same seed always gives the same dice on every platform
+struct RandomDice : DiceSource
+{
+    Xoshiro256 rng;
+
+    explicit RandomDice(uint64_t seed = 1) : rng(seed)
+    {
+    }
+
+    int nextDie() override
+    {
+        return (int)rng.below(6) + 1;
+    }
+};
+
+// Dice taken in order from a fixed list, starting again from the beginning once they run out
+struct ScriptedDice : DiceSource
+{
+    std::vector<int> dice;
+    size_t next = 0;
+
+    explicit ScriptedDice(const std::vector<int>& dice) : dice(dice)
+    {
+    }
+
+    int nextDie() override
+    {
+        if (next == dice.size())
+            next = 0;
+        return dice[next++];
+    }
+};
+
 // Struct for dice roll
 struct diceRoll
 {
-    // To hold each dice (each dice is the equivalent of a possible move)
-    std::vector<int> diceNums;
+    // To hold each dice (each dice is the equivalent of a possible move), doubles give four, only the first "count" are left to use
+    int diceNums[4];
+    int count = 0;
 
-    // Rolls dice
-    void rollDice()
+    // Rolls dice from the given source
+    void rollDice(DiceSource& source)
     {
-        diceNums.push_back(rand() % 6 + 1);
-        diceNums.push_back(rand() % 6 + 1);
+        METRIC_COUNT(Metric::ROLL_DICE);
+        int dieOne = source.nextDie();
+        int dieTwo = source.nextDie();
+        setDice(dieOne, dieTwo);
+    }
 
-        // If there are doubles add two more "moves" to diceNums 
-        if (diceNums[0] == diceNums[1])
+    // Sets the dice to a given roll, if there are doubles add two more "moves"
+    void setDice(int dieOne, int dieTwo)
+    {
+        diceNums[0] = dieOne;
+        diceNums[1] = dieTwo;
+        count = 2;
+        if (dieOne == dieTwo)
         {
-            diceNums.push_back(diceNums[0]);
-            diceNums.push_back(diceNums[0]);
+            diceNums[2] = diceNums[3] = dieOne;
+            count = 4;
         }
     }
 
+    // Returns the number of dice (moves) left
+    int size() const
+    {
+        return count;
+    }
+
+    bool empty() const
+    {
+        return count == 0;
+    }
+
+    void clear()
+    {
+        count = 0;
+    }
+
+    // Removes the first dice once its move has been made
+    void useFirst()
+    {
+        for (int i = 1; i < count; i++)
+            diceNums[i - 1] = diceNums[i];
+        count--;
+    }
+
     // Swap dice order
     void swap()
     {
-        // If there are more than two items in diceNums that means "moves" are doubles and all "moves" are the same number
-        if (diceNums.size() > 2)
+        // If there are more than two items in diceNums that means "moves" are doubles and all "moves" are the same number,
+        // with one left there is nothing to swap with
+        if (count != 2)
             return;
         int temp = diceNums[1];
         diceNums[1] = diceNums[0];
@@ -58,508 +408,7007 @@ struct Move
     int to;
 };
 
-// Struct for the game state
-struct GameState
+// Maximum number of distinct plays for a single roll (four moves of a double spread over 15 pieces)
+const int MAX_PLAYS = 3060;
+
+// Struct for one full play, every move made with a roll in the same (from point, to point) format as currentMove
+struct Play
 {
-    // The board is represented as an array of integers, with
-    // each index representing a point on the board. The value
-    // of each element is the number of pieces on that point.
-    int board[25];
+    // The moves in the order they are made and the dice used for each of them
+    Move moves[4];
+    int dice[4];
 
-    // The number of pieces each player has on the bar (in the center of the board)
-    int whiteBar, blackBar;
+    // Number of moves in the play, 0 means the player has no valid moves and the turn is voided
+    int numMoves;
+};
 
-    // The number of pieces each player has in their home quadrant 
-    int whiteGoal, blackGoal;
+// Struct holding every legal play for a roll, sized so that generating plays never allocates
+struct PlayList
+{
+    // Each distinct play and the packed resulting position it was de-duplicated on
+    Play plays[MAX_PLAYS];
+    uint64_t keys[MAX_PLAYS][2];
+    int count;
 
-    // The current player
-    Player currentPlayer;
+    // The number of dice used by every legal play
+    int maxMoves;
 
-    // The current move
-    Move currentMove;
+    // firstDie[n] is true if some legal play starts by using a dice showing n
+    bool firstDie[7];
 
-    // Struct to hold dice (moves) information 
-    diceRoll dice;
+    // Open addressing table of resulting positions, an entry is (generation << 12 | play index + 1)
+    uint32_t table[8192];
+    uint32_t generation = 0;
 
-    // Message for player after each turn 
-    std::string Message;
+    // Empties the list, old table entries become stale by bumping the generation instead of clearing them
+    void reset()
+    {
+        count = 0;
+        for (int i = 0; i < 7; i++)
+            firstDie[i] = false;
+        generation++;
+        if (generation == (1u << 20))
+        {
+            generation = 1;
+            for (uint32_t& entry : table)
+                entry = 0;
+        }
+    }
 
-    // Returns players ability to bear off, they should have all their pieces in the home quadrant or have already scored at least once 
-    // For the points in a player's home, sum the number of pieces, return if that value equals NUM_PIECES or 15 or check if the player has already scored at least one 
-    bool canBearOff()
+    // Adds a play unless a play with the same resulting position is already in the list
+    void add(const Play& play, uint64_t keyLow, uint64_t keyHigh)
     {
-        int total = 0;
-        if (currentPlayer == Player::WHITE)
+        uint64_t hash = (keyLow ^ (keyHigh * 0x9E3779B97F4A7C15ULL)) * 0xBF58476D1CE4E5B9ULL;
+        uint32_t slot = (uint32_t)(hash >> 51);
+        while (true)
         {
-            if (whiteGoal > 0)
-                return true;
-            for (int i = 0; i < 6; i++)
+            uint32_t entry = table[slot];
+            // An empty (or stale) slot means the position is new
+            if ((entry >> 12) != generation)
             {
-                if (board[i] < 0)
-                    total += abs(board[i]);
+                keys[count][0] = keyLow;
+                keys[count][1] = keyHigh;
+                plays[count] = play;
+                count++;
+                table[slot] = (generation << 12) | (uint32_t)count;
+                return;
             }
+            int index = (entry & 0xFFF) - 1;
+            if (keys[index][0] == keyLow && keys[index][1] == keyHigh)
+                return;
+            slot = (slot + 1) & 8191;
         }
-        else
+    }
+};
+
+// One side's view of the board used by the move generator. Each side counts points from its own home:
+// index 1-24 are points, 25 is the bar and 0 holds the pieces already borne off
+struct SideBoard
+{
+    int8_t own[26];
+    int8_t opp[26];
+
+    // Makes the moves of a play generated for "player", who must be the side this board is seen from
+    void applyPlay(const Play& play, Player player)
+    {
+        for (int i = 0; i < play.numMoves; i++)
         {
-            if (blackGoal > 0)
-                return true;
-            for (int i = 18; i < 24; i++)
+            // Board indexes are turned back into points counted from the mover's home 
+            int from = play.moves[i].from == -1 ? 25 : (player == Player::WHITE ? play.moves[i].from + 1 : 24 - play.moves[i].from);
+            int to = play.moves[i].to == 24 ? 0 : (player == Player::WHITE ? play.moves[i].to + 1 : 24 - play.moves[i].to);
+            own[from]--;
+            own[to]++;
+            if (to > 0 && opp[25 - to] == 1)
             {
-                if (board[i] > 0)
-                    total += board[i];
+                opp[25 - to] = 0;
+                opp[25]++;
             }
         }
-        return total == NUM_PIECES;
     }
 
-    // Member function to check player's move 
-    bool checkMove()
+    // Returns the points won once every own piece is borne off: 1, 2 for a gammon (the opponent has borne off
+    // nothing) or 3 for a backgammon (the opponent also has a piece on the bar or in this side's home quadrant)
+    int winPoints() const
     {
-        // If the player has barred pieces but didn't try to move them 
-        if (currentMove.from != -1 && (currentPlayer == Player::WHITE ? whiteBar : blackBar))
-        {
-            Message = " has at least one barred piece";
-            return false;
-        }
+        if (opp[0] > 0)
+            return 1;
+        for (int point = 19; point <= 25; point++)
+            if (opp[point])
+                return 3;
+        return 2;
+    }
+};
 
-        // If the player doesn't have barred pieces but tried to move them
-        if (currentMove.from == -1 && (currentPlayer == Player::WHITE ? !whiteBar : !blackBar))
-        {
-            Message = " does not have any barred pieces";
-            return false;
-        }
+// Struct that walks every sequence of moves for a roll and collects the distinct full plays
+struct PlayGenerator
+{
+    SideBoard side;
+    Player player;
+    int dice[4];
+    int numDice;
+    bool doubles;
 
-        // If the player is trying to bear off but can't
-        if (currentMove.to == 24 && !canBearOff())
+    // The moves of the sequence currently being walked (points counted from the mover's home)
+    int pathFrom[4];
+    int pathTo[4];
+    int pathDice[4];
+
+    // Points 1-24 where an opponent's piece has been hit in the current sequence
+    uint32_t hitMask;
+
+    // The mover's farthest piece from home (25 is the bar), set by the caller and kept up to date by tryMove
+    int farthest;
+
+    // Set by the caller when the sides have passed each other, the moves can then neither be blocked nor hit
+    bool race;
+
+    PlayList* plays;
+
+    // Converts a point counted from the mover's home to a board index (-1 for the bar, 24 for bearing off)
+    int toBoardIndex(int point) const
+    {
+        if (point >= 25)
+            return -1;
+        if (point <= 0)
+            return 24;
+        return player == Player::WHITE ? point - 1 : 24 - point;
+    }
+
+    // Returns the farthest point from home at or below "point" that holds one of the mover's pieces
+    int farthestPiece(int point) const
+    {
+        while (point > 0 && side.own[point] == 0)
+            point--;
+        return point;
+    }
+
+    // Fills plays with every legal play for the dice
+    void generate(const int rollDice[], int count, PlayList& out)
+    {
+        plays = &out;
+        plays->reset();
+        plays->maxMoves = 0;
+        hitMask = 0;
+        numDice = count;
+        doubles = count != 2 || rollDice[0] == rollDice[1];
+
+        // Try the larger dice first so that when either dice reaches the same position the larger one is kept
+        if (doubles)
         {
-            Message = " cannot bear off"; 
-            return false;
+            for (int i = 0; i < count; i++)
+                dice[i] = rollDice[i];
+            searchRoll();
         }
+        else
+        {
+            int high = rollDice[0] > rollDice[1] ? rollDice[0] : rollDice[1];
+            int low = rollDice[0] > rollDice[1] ? rollDice[1] : rollDice[0];
+            dice[0] = high;
+            dice[1] = low;
+            searchRoll();
+            dice[0] = low;
+            dice[1] = high;
+            searchRoll();
 
-        // If the player is trying to move from bar but can't ->
-        if (currentPlayer == Player::WHITE && currentMove.from == -1)
-            // If the point "to" is occupied by more than one opponent piece or the move is not allowed using current dice->
-            if (board[currentMove.to] > 1 || BOARD_SIZE - currentMove.to != dice.diceNums[0])
-            {
-                Message = " cannot move from bar to point: " + std::to_string(currentMove.to + 1);
-                return false;
-            }
-        if (currentPlayer == Player::BLACK && currentMove.from == -1)
-            if (board[currentMove.to] < -1 || currentMove.to + 1 != dice.diceNums[0])
-            {
-                Message = " cannot move from bar to point: " + std::to_string(currentMove.to + 1);
-                return false;
-            }
-
-        // If the player is trying to bear off and can't ->
-        if (currentPlayer == Player::WHITE && currentMove.to == 24)
-            // If the move is not allowed using current dice or there is no piece at the point "from" ->
-            if (currentMove.from + 1 > dice.diceNums[0] || board[currentMove.from] > -1)
-            {
-                Message = " cannot bear off from here, the piece is too far from home or you have no pieces at point: " + std::to_string(currentMove.from + 1);
-                return false;
-            }
-            // If the move is allowed using current dice ->
-            else if (currentMove.from + 1 < dice.diceNums[0])
-            {
-                // For all points preceding "from" in home quadrant 
-                for (int point = currentMove.from + 1; point < 6; point++)
-                    // If there is a piece at point "point" -> 
-                    if (board[point] < 0)
-                    {
-                        Message = " cannot bear off from point: " + std::to_string(currentMove.from + 1) + ", there are pieces in higher positions in your home";
-                        return false;
-                    }
-            }
-        if (currentPlayer == Player::BLACK && currentMove.to == 24)
-            if (24 - currentMove.from > dice.diceNums[0] || board[currentMove.from] < 1)
-            {
-                Message = " cannot bear off from here, the piece is too far from home or you have no pieces at point: " + std::to_string(currentMove.from + 1);
-                return false;
-            }
-            else if (24 - currentMove.from < dice.diceNums[0])
+            // If only one dice can be used the player has to use the larger one when possible
+            if (plays->maxMoves == 1 && plays->firstDie[high])
             {
-                for (int point = currentMove.from - 1; point > 17; point--)
-                    if (board[point] > 0)
+                int kept = 0;
+                for (int i = 0; i < plays->count; i++)
+                    if (plays->plays[i].dice[0] == high)
                     {
-                        Message = " cannot bear off from point: " + std::to_string(currentMove.from + 1) + ", there are pieces in higher positions in your home";
-                        return false;
+                        plays->plays[kept] = plays->plays[i];
+                        plays->keys[kept][0] = plays->keys[i][0];
+                        plays->keys[kept][1] = plays->keys[i][1];
+                        kept++;
                     }
+                plays->count = kept;
+                plays->firstDie[low] = false;
             }
-
-        // If the player is trying to move (not from the bar and not bearing off) and can't ->
-        if (currentMove.from != -1 && currentMove.to != 24)
-        {
-            // If the current player is WHITE -> 
-            if (currentPlayer == Player::WHITE)
-                // If there are no pieces at the point "from" or there is more than one opponent piece at point "to" or the move is not allowed using current dice ->
-                if (board[currentMove.from] > -1 || board[currentMove.to] > 1 || currentMove.from - currentMove.to != dice.diceNums[0])
-                {
-                    Message = " cannot move from point: " + std::to_string(currentMove.from + 1) + " to point: " + std::to_string(currentMove.to + 1);
-                    return false;
-                }
-            if (currentPlayer == Player::BLACK)
-                if (board[currentMove.from] < 1 || board[currentMove.to] < -1 || currentMove.from - currentMove.to != dice.diceNums[0] * -1)
-                {
-                    Message = " cannot move from point: " + std::to_string(currentMove.from + 1) + " to point: " + std::to_string(currentMove.to + 1);
-                    return false;
-                }
         }
+    }
+
+    // Walks every sequence for the dice in their current order, with the checks for blocked points, hits and the bar
+    // left out in a race
+    void searchRoll()
+    {
+        if (race)
+            search<true>(0, 25);
+        else
+            search<false>(0, 25);
+    }
 
-        // If the function has not returned the move is valid, check if there is a hit if the player is not bearing off 
-        if (currentMove.to != 24)
-            // If the point "to" has one opponent piece -> 
-            if (board[currentMove.to] == (currentPlayer == Player::WHITE ? 1 : -1))
+    // Tries every move for dice number "depth", for doubles only pieces at or closer than "lastFrom" are moved
+    // since moving them in any other order reaches the same positions
+    template <bool RACE>
+    void search(int depth, int lastFrom)
+    {
+        bool moved = false;
+        if (depth < numDice)
+        {
+            int die = dice[depth];
+            // Pieces on the bar have to be entered before anything else
+            if (!RACE && side.own[25] > 0)
+                moved = tryMove<RACE>(depth, 25, die);
+            else
             {
-                currentPlayer == Player::WHITE ? blackBar++ : whiteBar++;
-                currentPlayer == Player::WHITE ? board[currentMove.to]-- : board[currentMove.to]++;
-                std::cout << currentPlayer << " hit at point: " << currentMove.to+1 << std::endl;
+                int start = doubles && lastFrom < farthest ? lastFrom : farthest;
+                for (int point = start; point > 0; point--)
+                    if (side.own[point] > 0 && tryMove<RACE>(depth, point, die))
+                        moved = true;
             }
+        }
+        if (!moved)
+            record(depth);
+    }
 
-        // Make move
-        // If the player is moving from bar 
-        if (currentMove.from == -1)
+    // Makes the move from "point" using "die" if it is legal, searches the rest of the roll and takes it back
+    template <bool RACE>
+    bool tryMove(int depth, int point, int die)
+    {
+        int to = point - die;
+        if (to >= 1)
         {
-            currentPlayer == Player::WHITE ? whiteBar-- : blackBar--;
-            currentPlayer == Player::WHITE ? board[currentMove.to]-- : board[currentMove.to]++;
-            Message = " moved from bar to point: " + std::to_string(currentMove.to+1);
+            // The point is blocked by two or more of the opponent's pieces
+            if (!RACE && side.opp[25 - to] >= 2)
+                return false;
         }
-        // If the player is bearing off 
-        else if (currentMove.to == 24)
+        else
         {
-            currentPlayer == Player::WHITE ? whiteGoal++ : blackGoal++;
-            currentPlayer == Player::WHITE ? board[currentMove.from]++ : board[currentMove.from]--;
-            Message = " beared off from point: " + std::to_string(currentMove.from+1);
+            // Bearing off needs every piece in the home quadrant, and a dice higher than needed
+            // can only be used on the farthest piece
+            if (farthest > 6 || (to < 0 && farthest != point))
+                return false;
+            to = 0;
         }
-        // Otherwise it is a normal move 
-        else
+
+        bool hit = !RACE && to > 0 && side.opp[25 - to] == 1;
+        int lastFarthest = farthest;
+        side.own[point]--;
+        side.own[to]++;
+        if (point == farthest && side.own[point] == 0)
+            farthest = farthestPiece(point);
+        if (hit)
         {
-            currentPlayer == Player::WHITE ? board[currentMove.from]++ : board[currentMove.from]--;
-            currentPlayer == Player::WHITE ? board[currentMove.to]-- : board[currentMove.to]++;
-            Message = " moved from point: " + std::to_string(currentMove.from+1) + " to point: " + std::to_string(currentMove.to+1);
+            side.opp[25 - to] = 0;
+            side.opp[25]++;
+            hitMask |= 1u << (to - 1);
         }
+        pathFrom[depth] = point;
+        pathTo[depth] = to;
+        pathDice[depth] = die;
 
+        search<RACE>(depth + 1, point);
+
+        if (hit)
+        {
+            side.opp[25 - to] = 1;
+            side.opp[25]--;
+            hitMask &= ~(1u << (to - 1));
+        }
+        side.own[to]--;
+        side.own[point]++;
+        farthest = lastFarthest;
         return true;
     }
 
-    // Adjust dice based on available moves, called before the player enters their move 
-    void adjustDice()
+    // Records the sequence walked so far as a full play if it uses as many dice as possible
+    void record(int depth)
     {
-        // If the player cannot enter their piece(s) from the bar ->
-        if (currentPlayer == Player::WHITE && whiteBar)
-        {
-            // If the player cannot enter their piece from the bar with dice one ->
-            if (board[BOARD_SIZE - dice.diceNums[0]] >= 2)
-            {
-                // If the player only has one dice or the dice is doubles->
-                if (dice.diceNums.size() == 1 || dice.diceNums.size() > 2)
-                {
-                    Message += "\n~ has no valid moves, voiding turn, diceOne: " + std::to_string(dice.diceNums[0]) + " diceTwo: " + std::to_string(dice.diceNums[1]);
-                    dice.diceNums.clear();
-                    return;
-                }
-                // If the player cannot move from the bar with the dice two either ->
-                else if (board[BOARD_SIZE - dice.diceNums[1]] >= 2)
-                {
-                    Message += "\n~ has no valid moves, voiding turn, diceOne: " + std::to_string(dice.diceNums[0]) + " diceTwo: " + std::to_string(dice.diceNums[1]);
-                    dice.diceNums.clear();
-                    return;
-                }
-                // Otherwise the player will have to use dice two to move first 
-                else
-                {
-                    dice.swap();
-                    return;
-                }
-            }
-            // Otherwise the player can move with dice one 
+        if (depth < plays->maxMoves)
             return;
+        if (depth > plays->maxMoves)
+        {
+            plays->reset();
+            plays->maxMoves = depth;
         }
-        // If the player cannot enter their piece(s) from the bar (BLACK)-> 
-        if (currentPlayer == Player::BLACK && blackBar)
+        if (depth > 0)
+            plays->firstDie[pathDice[0]] = true;
+
+        // The resulting position is packed as the mover's pieces on points 1-25 (4 bits each) plus the points
+        // where the opponent was hit, which is all that can differ between plays
+        uint64_t keyLow = 0;
+        uint64_t keyHigh = hitMask;
+        for (int point = 1; point <= 16; point++)
+            keyLow = (keyLow << 4) | (uint64_t)side.own[point];
+        for (int point = 17; point <= 25; point++)
+            keyHigh = (keyHigh << 4) | (uint64_t)side.own[point];
+
+        Play play;
+        play.numMoves = depth;
+        for (int i = 0; i < depth; i++)
         {
-            if (board[dice.diceNums[0] - 1] <= -2)
-            {
-                if (dice.diceNums.size() == 1 || dice.diceNums.size() > 2)
+            play.moves[i].from = toBoardIndex(pathFrom[i]);
+            play.moves[i].to = toBoardIndex(pathTo[i]);
+            play.dice[i] = pathDice[i];
+        }
+        plays->add(play, keyLow, keyHigh);
+    }
+};
+
+// Random keys for Zobrist hashing, one for every (player, point, number of pieces) where point 24 is the bar.
+// The pieces in the goal are not hashed since they follow from the rest of the position
+struct ZobristKeys
+{
+    uint64_t pieces[2][25][16];
+    uint64_t blackToMove;
+
+    // Fills the keys from a fixed SplitMix64 sequence so hashes are the same on every run
+    ZobristKeys()
+    {
+        uint64_t seed = 0x2545F4914F6CDD1DULL;
+        for (int player = 0; player < 2; player++)
+            for (int point = 0; point < 25; point++)
+                for (int count = 0; count < 16; count++)
+                    pieces[player][point][count] = splitMix(seed);
+        blackToMove = splitMix(seed);
+    }
+
+    static uint64_t splitMix(uint64_t& state)
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+};
+
+const ZobristKeys ZOBRIST;
+
+// Compact key for a position in the same 80 bit layout as the standard backgammon position ID: for the player
+// not on roll and then the player on roll, every point 1-24 (counted from that player's home) and the bar is
+// written as one bit per piece followed by a zero bit
+struct PositionKey
+{
+    uint8_t data[10];
+
+    bool operator==(const PositionKey& other) const
+    {
+        for (int i = 0; i < 10; i++)
+            if (data[i] != other.data[i])
+                return false;
+        return true;
+    }
+};
+
+// Values of an evaluation stored in the transposition table
+enum class Bound : uint8_t { EXACT, LOWER, UPPER };
+
+struct TableEntry
+{
+    float value;
+    int depth;
+    Bound bound;
+};
+
+// Fixed-size table of evaluations keyed by position hash, shared by every thread without locks. Each slot holds
+// the packed entry and the hash XORed with it, so a slot torn by two threads writing at once fails the check on probe.
+// Entries carry the generation they were stored in and only the current generation is found, so newSearch drops every
+// stored result without touching the slots
+class TranspositionTable
+{
+public:
+    // The table has 2^bits slots, two slots form a bucket
+    explicit TranspositionTable(int bits = 20)
+        : slots(new Slot[(size_t)1 << bits]), mask((((uint64_t)1 << bits) - 1) & ~(uint64_t)1)
+    {
+        clear();
+    }
+
+    // Starts a new generation, results stored before it are no longer found. The slots are only zeroed when the
+    // generation number wraps around, so an entry from 256 searches back can never come back
+    void newSearch()
+    {
+        uint64_t next = (generation.load(std::memory_order_relaxed) + 1) & 0xFF;
+        if (next == 0)
+        {
+            clear();
+            next = 1;
+        }
+        generation.store(next, std::memory_order_relaxed);
+    }
+
+    void clear()
+    {
+        for (uint64_t i = 0; i <= (mask | 1); i++)
+        {
+            slots[i].check.store(0, std::memory_order_relaxed);
+            slots[i].data.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Returns true and fills entry if the position with this hash has been stored
+    bool probe(uint64_t hash, TableEntry& entry) const
+    {
+        const Slot* bucket = &slots[hash & mask];
+        for (int i = 0; i < 2; i++)
+        {
+            uint64_t data = bucket[i].data.load(std::memory_order_relaxed);
+            uint64_t check = bucket[i].check.load(std::memory_order_relaxed);
+            if (data != 0 && (check ^ data) == hash && (data >> 49) == generation.load(std::memory_order_relaxed))
+            {
+                entry = unpack(data);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Stores an entry, the first slot of a bucket keeps the deepest entry and the second always takes the newest
+    void store(uint64_t hash, const TableEntry& entry)
+    {
+        Slot* bucket = &slots[hash & mask];
+        uint64_t current = generation.load(std::memory_order_relaxed);
+        uint64_t data = pack(entry) | (current << 49);
+        uint64_t first = bucket[0].data.load(std::memory_order_relaxed);
+        uint64_t firstCheck = bucket[0].check.load(std::memory_order_relaxed);
+        Slot& slot = ((firstCheck ^ first) == hash || first == 0 || (first >> 49) != current || unpack(first).depth <= entry.depth) ? bucket[0] : bucket[1];
+        slot.data.store(data, std::memory_order_relaxed);
+        slot.check.store(hash ^ data, std::memory_order_relaxed);
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<uint64_t> check;
+        std::atomic<uint64_t> data;
+    };
+
+    // An entry is packed as the value's bits, then the depth and the bound, with a marker bit so no entry packs to 0.
+    // The generation goes in the bits above the marker
+    static uint64_t pack(const TableEntry& entry)
+    {
+        uint32_t bits;
+        std::memcpy(&bits, &entry.value, sizeof(bits));
+        return (uint64_t)bits | ((uint64_t)(uint8_t)entry.depth << 32) | ((uint64_t)entry.bound << 40) | (1ULL << 48);
+    }
+
+    static TableEntry unpack(uint64_t data)
+    {
+        TableEntry entry;
+        uint32_t bits = (uint32_t)data;
+        std::memcpy(&entry.value, &bits, sizeof(bits));
+        entry.depth = (int)(uint8_t)(data >> 32);
+        entry.bound = (Bound)(uint8_t)(data >> 40);
+        return entry;
+    }
+
+    std::unique_ptr<Slot[]> slots;
+    uint64_t mask;
+    std::atomic<uint64_t> generation{1};
+};
+
+// How one player's pieces sit on the board, so the rules can be written once and compiled for each player
+// WHITE's pieces are negative numbers and its point 1 is index 0, BLACK's are positive and its point 1 is index 23
+template <Player P>
+struct PlayerSide
+{
+    // 0 for WHITE and 1 for BLACK, the index of the player in per player arrays
+    static const int INDEX = P == Player::WHITE ? 0 : 1;
+
+    // Sign of the player's pieces on the board
+    static const int SIGN = P == Player::WHITE ? -1 : 1;
+
+    static const Player OTHER = P == Player::WHITE ? Player::BLACK : Player::WHITE;
+
+    // Returns the point counted from the player's home (1-24) for a board index
+    static int point(int index)
+    {
+        return P == Player::WHITE ? index + 1 : BOARD_SIZE - index;
+    }
+
+    // Returns the board index of a point counted from the player's home
+    static int index(int point)
+    {
+        return P == Player::WHITE ? point - 1 : BOARD_SIZE - point;
+    }
+
+    // Returns how many of the player's pieces, or of the opponent's pieces, a board value holds (negative for the other side)
+    static int pieces(int value)
+    {
+        return value * SIGN;
+    }
+
+    static int oppPieces(int value)
+    {
+        return -value * SIGN;
+    }
+};
+
+// What applyMove changed, enough for undoMove to put the position back exactly
+struct MoveUndo
+{
+    Move move;
+    bool hit;
+    uint64_t hash;
+    int8_t farthest[2];
+};
+
+// Struct for the game state
+struct GameState
+{
+    // The board is represented as an array of integers, with
+    // each index representing a point on the board. The value
+    // of each element is the number of pieces on that point.
+    int board[25];
+
+    // The number of pieces each player has on the bar (in the center of the board)
+    int whiteBar, blackBar;
+
+    // The number of pieces each player has in their home quadrant 
+    int whiteGoal, blackGoal;
+
+    // The current player
+    Player currentPlayer;
+
+    // Struct to hold dice (moves) information 
+    diceRoll dice;
+
+    // Zobrist hash of the position and the player to move, kept up to date by every move 
+    uint64_t hash;
+
+    // For each player (0 for WHITE, 1 for BLACK): the pip count, the number of pieces on the home quadrant and the
+    // farthest point from home holding a piece (25 is the bar, 0 once every piece is off), kept up to date by every move
+    int pips[2];
+    int homePieces[2];
+    int farthest[2];
+
+    // Returns players ability to bear off, they should have all their pieces in the home quadrant or have already scored at least once 
+    bool canBearOff() const
+    {
+        if (currentPlayer == Player::WHITE)
+            return whiteGoal > 0 || homePieces[0] == NUM_PIECES;
+        return blackGoal > 0 || homePieces[1] == NUM_PIECES;
+    }
+
+    // Member function to check a move of the current player using the given dice, the board is not changed
+    MoveError validateMove(const Move& move, int die) const
+    {
+        MoveError error = currentPlayer == Player::WHITE ? validateMoveFor<Player::WHITE>(move, die) : validateMoveFor<Player::BLACK>(move, die);
+        METRIC_MOVE_CHECK(error);
+        return error;
+    }
+
+    // Moves one of the current player's pieces without validating the move, used once a move is known to be legal
+    // Returns what was changed, including whether a lone opponent piece at point "to" was hit, so it can be undone
+    MoveUndo applyMove(const Move& move)
+    {
+        if (currentPlayer == Player::WHITE)
+            return applyMoveFor<Player::WHITE>(move);
+        return applyMoveFor<Player::BLACK>(move);
+    }
+
+    // Takes back a move made with applyMove, it must be the last move made and by the same player
+    void undoMove(const MoveUndo& undo)
+    {
+        if (currentPlayer == Player::WHITE)
+            undoMoveFor<Player::WHITE>(undo);
+        else
+            undoMoveFor<Player::BLACK>(undo);
+    }
+
+    // The rules below are written once for the player to move "P" and compiled separately for each player,
+    // the public functions above pick the version for the current player
+
+    // Returns the number of pieces "P" has on the bar or in the goal
+    template <Player P>
+    int& barOf()
+    {
+        return P == Player::WHITE ? whiteBar : blackBar;
+    }
+
+    template <Player P>
+    int barOf() const
+    {
+        return P == Player::WHITE ? whiteBar : blackBar;
+    }
+
+    template <Player P>
+    int& goalOf()
+    {
+        return P == Player::WHITE ? whiteGoal : blackGoal;
+    }
+
+    template <Player P>
+    int goalOf() const
+    {
+        return P == Player::WHITE ? whiteGoal : blackGoal;
+    }
+
+    template <Player P>
+    MoveError validateMoveFor(const Move& move, int die) const
+    {
+        typedef PlayerSide<P> Own;
+
+        // If the player has barred pieces but didn't try to move them 
+        if (move.from != -1 && barOf<P>())
+            return MoveError::MUST_MOVE_FROM_BAR;
+
+        // If the player doesn't have barred pieces but tried to move them
+        if (move.from == -1 && !barOf<P>())
+            return MoveError::NOTHING_ON_BAR;
+
+        // If the player is trying to bear off but can't
+        if (move.to == 24 && !canBearOff())
+            return MoveError::CANNOT_BEAR_OFF;
+
+        // If the player is trying to move from bar but can't ->
+        // If the point "to" is occupied by more than one opponent piece or the move is not allowed using current dice->
+        if (move.from == -1)
+            if (Own::oppPieces(board[move.to]) > 1 || Own::point(move.to) != 25 - die)
+                return MoveError::BAR_BLOCKED;
+
+        // If the player is trying to bear off and can't ->
+        if (move.to == 24)
+        {
+            int from = Own::point(move.from);
+            // If the move is not allowed using current dice or there is no piece at the point "from" ->
+            if (from > die || Own::pieces(board[move.from]) < 1)
+                return MoveError::BEAR_OFF_TOO_FAR;
+            // If the move is allowed using current dice ->
+            if (from < die)
+            {
+                // For all points preceding "from" in home quadrant 
+                for (int point = from + 1; point <= 6; point++)
+                    // If there is a piece at point "point" -> 
+                    if (Own::pieces(board[Own::index(point)]) > 0)
+                        return MoveError::BEAR_OFF_HIGHER_PIECES;
+            }
+        }
+
+        // If the player is trying to move (not from the bar and not bearing off) and can't ->
+        // If there are no pieces at the point "from" or there is more than one opponent piece at point "to" or the move is not allowed using current dice ->
+        if (move.from != -1 && move.to != 24)
+            if (Own::pieces(board[move.from]) < 1 || Own::oppPieces(board[move.to]) > 1 || Own::point(move.from) - Own::point(move.to) != die)
+                return MoveError::BLOCKED;
+
+        // If the function has not returned the move is valid
+        return MoveError::NONE;
+    }
+
+    template <Player P>
+    MoveUndo applyMoveFor(const Move& move)
+    {
+        typedef PlayerSide<P> Own;
+        const int own = Own::INDEX;
+        const int opp = 1 - own;
+        MoveUndo undo = { move, false, hash, { (int8_t)farthest[0], (int8_t)farthest[1] } };
+        int fromPoint = move.from == -1 ? 25 : Own::point(move.from);
+        int toPoint = move.to == 24 ? 0 : Own::point(move.to);
+
+        // If the point "to" has one opponent piece send it to the bar 
+        if (move.to != 24 && Own::oppPieces(board[move.to]) == 1)
+        {
+            int& bar = barOf<PlayerSide<P>::OTHER>();
+            hashPieces(opp, move.to, 1, 0);
+            hashPieces(opp, 24, bar, bar + 1);
+            bar++;
+            board[move.to] = 0;
+            undo.hit = true;
+            countHit(opp, 25 - toPoint, 1);
+        }
+
+        // Take the piece from the bar or from point "from" 
+        if (move.from == -1)
+        {
+            int& bar = barOf<P>();
+            hashPieces(own, 24, bar, bar - 1);
+            bar--;
+        }
+        else
+        {
+            int pieces = Own::pieces(board[move.from]);
+            hashPieces(own, move.from, pieces, pieces - 1);
+            board[move.from] -= Own::SIGN;
+        }
+
+        // Put the piece in the goal or on point "to" 
+        if (move.to == 24)
+            goalOf<P>()++;
+        else
+        {
+            int pieces = Own::pieces(board[move.to]);
+            hashPieces(own, move.to, pieces, pieces + 1);
+            board[move.to] += Own::SIGN;
+        }
+
+        // Only the mover's pieces between the two points changed, so the farthest piece is searched for
+        // again only when the move emptied it
+        countMove(own, fromPoint, toPoint);
+        if (fromPoint == farthest[own] && piecesAt(own, fromPoint) == 0)
+        {
+            int point = fromPoint;
+            while (point > 0 && piecesAt(own, point) == 0)
+                point--;
+            farthest[own] = point;
+        }
+
+#ifdef CHECK_COUNTERS
+        checkCounters();
+#endif
+        return undo;
+    }
+
+    template <Player P>
+    void undoMoveFor(const MoveUndo& undo)
+    {
+        typedef PlayerSide<P> Own;
+        const Move& move = undo.move;
+
+        // Take the piece off point "to" or out of the goal 
+        if (move.to == 24)
+            goalOf<P>()--;
+        else
+            board[move.to] -= Own::SIGN;
+
+        // Put it back on the bar or on point "from" 
+        if (move.from == -1)
+            barOf<P>()++;
+        else
+            board[move.from] += Own::SIGN;
+
+        // Bring back the opponent piece that was hit 
+        int toPoint = move.to == 24 ? 0 : Own::point(move.to);
+        if (undo.hit)
+        {
+            board[move.to] = -Own::SIGN;
+            barOf<PlayerSide<P>::OTHER>()--;
+            countHit(1 - Own::INDEX, 25 - toPoint, -1);
+        }
+        countMove(Own::INDEX, toPoint, move.from == -1 ? 25 : Own::point(move.from));
+        farthest[0] = undo.farthest[0];
+        farthest[1] = undo.farthest[1];
+        hash = undo.hash;
+
+#ifdef CHECK_COUNTERS
+        checkCounters();
+#endif
+    }
+
+    // Returns the number of "player"'s pieces on a point counted from their home (25 is the bar, 0 is borne off)
+    int piecesAt(int player, int point) const
+    {
+        if (point == 25)
+            return player == 0 ? whiteBar : blackBar;
+        if (point == 0)
+            return player == 0 ? whiteGoal : blackGoal;
+        int pieces = player == 0 ? -board[point - 1] : board[BOARD_SIZE - point];
+        return pieces > 0 ? pieces : 0;
+    }
+
+    // Updates the counters for one of "player"'s pieces going from "fromPoint" to "toPoint" (points counted from their home)
+    void countMove(int player, int fromPoint, int toPoint)
+    {
+        pips[player] -= fromPoint - toPoint;
+        homePieces[player] += (toPoint >= 1 && toPoint <= 6) - (fromPoint >= 1 && fromPoint <= 6);
+    }
+
+    // Updates the counters for "player"'s piece on "point" being hit (sign 1) or put back (sign -1), undoMove
+    // restores the farthest piece itself
+    void countHit(int player, int point, int sign)
+    {
+        countMove(player, sign > 0 ? point : 25, sign > 0 ? 25 : point);
+        if (sign > 0)
+            farthest[player] = 25;
+    }
+
+    // Counts the pip counts, home pieces and farthest pieces of both players from scratch
+    void countPieces(int outPips[2], int outHome[2], int outFarthest[2]) const
+    {
+        for (int player = 0; player < 2; player++)
+        {
+            outPips[player] = 0;
+            outHome[player] = 0;
+            outFarthest[player] = 0;
+            for (int point = 1; point <= 25; point++)
+            {
+                int pieces = piecesAt(player, point);
+                outPips[player] += pieces * point;
+                if (point <= 6)
+                    outHome[player] += pieces;
+                if (pieces)
+                    outFarthest[player] = point;
+            }
+        }
+    }
+
+#ifdef CHECK_COUNTERS
+    // Debug builds compare the counters with a full count after every move and stop at the first difference
+    void checkCounters() const
+    {
+        int countedPips[2], countedHome[2], countedFarthest[2];
+        countPieces(countedPips, countedHome, countedFarthest);
+        for (int player = 0; player < 2; player++)
+            if (pips[player] != countedPips[player] || homePieces[player] != countedHome[player] || farthest[player] != countedFarthest[player])
+            {
+                std::cerr << "Counters for " << (player == 0 ? "White" : "Black") << " are pips " << pips[player] << " home " << homePieces[player]
+                    << " farthest " << farthest[player] << " but the board has " << countedPips[player] << " " << countedHome[player]
+                    << " " << countedFarthest[player] << std::endl;
+                abort();
+            }
+    }
+#endif
+
+    // Updates the hash for "player" (0 for WHITE, 1 for BLACK) going from "before" to "after" pieces at a point (24 is the bar)
+    void hashPieces(int player, int point, int before, int after)
+    {
+        hash ^= ZOBRIST.pieces[player][point][before] ^ ZOBRIST.pieces[player][point][after];
+    }
+
+    // Passes the turn to the other player
+    void switchPlayer()
+    {
+        currentPlayer = (currentPlayer == Player::WHITE ? Player::BLACK : Player::WHITE);
+        hash ^= ZOBRIST.blackToMove;
+    }
+
+    // Recomputes the hash and the counters from scratch, needed after the board is changed directly instead of through applyMove
+    void rehash()
+    {
+        countPieces(pips, homePieces, farthest);
+        hash = currentPlayer == Player::BLACK ? ZOBRIST.blackToMove : 0;
+        for (int i = 0; i < BOARD_SIZE; i++)
+        {
+            hash ^= ZOBRIST.pieces[0][i][board[i] < 0 ? -board[i] : 0];
+            hash ^= ZOBRIST.pieces[1][i][board[i] > 0 ? board[i] : 0];
+        }
+        hash ^= ZOBRIST.pieces[0][24][whiteBar];
+        hash ^= ZOBRIST.pieces[1][24][blackBar];
+    }
+
+    // Returns the packed key of the position as seen by the current player
+    PositionKey positionKey() const
+    {
+        PositionKey key = {};
+        int bit = 0;
+        SideBoard side = sideBoard();
+        const int8_t* players[2] = { side.opp, side.own };
+        for (const int8_t* pieces : players)
+            for (int point = 1; point <= 25; point++)
+            {
+                for (int i = 0; i < pieces[point]; i++, bit++)
+                    key.data[bit >> 3] |= (uint8_t)(1 << (bit & 7));
+                bit++;
+            }
+        return key;
+    }
+
+    // Sets the board from a packed key as seen by the current player, returns false if the key is not a valid position
+    bool setPositionKey(const PositionKey& key)
+    {
+        SideBoard side = {};
+        int8_t* players[2] = { side.opp, side.own };
+        int bit = 0;
+        for (int8_t* pieces : players)
+        {
+            int total = 0;
+            for (int point = 1; point <= 25; point++)
+            {
+                while (bit < 80 && (key.data[bit >> 3] >> (bit & 7)) & 1)
+                {
+                    pieces[point]++;
+                    total++;
+                    bit++;
+                }
+                bit++;
+            }
+            if (total > NUM_PIECES || bit > 80)
+                return false;
+            pieces[0] = (int8_t)(NUM_PIECES - total);
+        }
+
+        // Both players cannot have pieces on the same point
+        for (int point = 1; point <= BOARD_SIZE; point++)
+            if (side.own[point] && side.opp[BOARD_SIZE + 1 - point])
+                return false;
+
+        bool white = currentPlayer == Player::WHITE;
+        for (int i = 0; i < BOARD_SIZE; i++)
+            board[i] = 0;
+        for (int point = 1; point <= BOARD_SIZE; point++)
+        {
+            // WHITE's point 1 is index 0 and BLACK's point 1 is index 23
+            int whitePieces = white ? side.own[point] : side.opp[point];
+            int blackPieces = white ? side.opp[point] : side.own[point];
+            if (whitePieces)
+                board[point - 1] = -whitePieces;
+            if (blackPieces)
+                board[BOARD_SIZE - point] = blackPieces;
+        }
+        whiteBar = white ? side.own[25] : side.opp[25];
+        blackBar = white ? side.opp[25] : side.own[25];
+        whiteGoal = white ? side.own[0] : side.opp[0];
+        blackGoal = white ? side.opp[0] : side.own[0];
+        rehash();
+        return true;
+    }
+
+    // Returns the 14 character position ID (the packed key in base 64) as seen by the current player
+    std::string positionID() const
+    {
+        static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        PositionKey key = positionKey();
+        std::string id;
+        for (int i = 0; i < 10; i += 3)
+        {
+            uint32_t group = (uint32_t)key.data[i] << 16;
+            if (i + 1 < 10)
+                group |= (uint32_t)key.data[i + 1] << 8;
+            if (i + 2 < 10)
+                group |= key.data[i + 2];
+            int chars = i + 3 <= 10 ? 4 : 2;
+            for (int c = 0; c < chars; c++)
+                id += digits[(group >> (18 - 6 * c)) & 63];
+        }
+        return id;
+    }
+
+    // Sets the board from a 14 character position ID as seen by the current player, returns false if it is not valid
+    bool setPositionID(const std::string& id)
+    {
+        if (id.size() != 14)
+            return false;
+        PositionKey key = {};
+        int bit = 0;
+        for (char c : id)
+        {
+            int value;
+            if (c >= 'A' && c <= 'Z')
+                value = c - 'A';
+            else if (c >= 'a' && c <= 'z')
+                value = c - 'a' + 26;
+            else if (c >= '0' && c <= '9')
+                value = c - '0' + 52;
+            else if (c == '+')
+                value = 62;
+            else if (c == '/')
+                value = 63;
+            else
+                return false;
+            // Each character holds 6 bits, most significant first within each byte
+            for (int b = 5; b >= 0; b--, bit++)
+                if (bit < 80 && (value >> b) & 1)
+                    key.data[bit >> 3] |= (uint8_t)(0x80 >> (bit & 7));
+        }
+        return setPositionKey(key);
+    }
+
+    // Makes every move of a play generated for the current player
+    void applyPlay(const Play& play)
+    {
+        MoveUndo undo[4];
+        applyPlay(play, undo);
+    }
+
+    // Makes every move of a play and keeps what is needed to take it back with undoPlay
+    void applyPlay(const Play& play, MoveUndo undo[4])
+    {
+        if (currentPlayer == Player::WHITE)
+            for (int i = 0; i < play.numMoves; i++)
+                undo[i] = applyMoveFor<Player::WHITE>(play.moves[i]);
+        else
+            for (int i = 0; i < play.numMoves; i++)
+                undo[i] = applyMoveFor<Player::BLACK>(play.moves[i]);
+    }
+
+    // Takes back a play made with applyPlay, last move first
+    void undoPlay(const MoveUndo undo[4], int numMoves)
+    {
+        if (currentPlayer == Player::WHITE)
+            for (int i = numMoves - 1; i >= 0; i--)
+                undoMoveFor<Player::WHITE>(undo[i]);
+        else
+            for (int i = numMoves - 1; i >= 0; i--)
+                undoMoveFor<Player::BLACK>(undo[i]);
+    }
+
+    // Returns true once the sides have passed each other, so no piece can be hit again and the game is a pure race.
+    // The farthest pieces are counted from opposite ends, they have passed when the points add up to less than 25
+    bool isRace() const
+    {
+        return farthest[0] + farthest[1] <= BOARD_SIZE;
+    }
+
+    // Returns the number of pips the player needs to bear off all their pieces, a piece on the bar needs 25
+    int pipCount(Player player) const
+    {
+        return pips[player == Player::WHITE ? 0 : 1];
+    }
+
+    // Returns the board seen from the current player's side, as used by the move generator
+    SideBoard sideBoard() const
+    {
+        if (currentPlayer == Player::WHITE)
+            return sideBoardFor<Player::WHITE>();
+        return sideBoardFor<Player::BLACK>();
+    }
+
+    template <Player P>
+    SideBoard sideBoardFor() const
+    {
+        typedef PlayerSide<P> Own;
+        typedef PlayerSide<PlayerSide<P>::OTHER> Opp;
+        SideBoard side;
+        for (int point = 1; point <= BOARD_SIZE; point++)
+        {
+            int ownPieces = Own::pieces(board[Own::index(point)]);
+            int oppPieces = Opp::pieces(board[Opp::index(point)]);
+            side.own[point] = (int8_t)(ownPieces > 0 ? ownPieces : 0);
+            side.opp[point] = (int8_t)(oppPieces > 0 ? oppPieces : 0);
+        }
+        side.own[25] = (int8_t)barOf<P>();
+        side.opp[25] = (int8_t)barOf<PlayerSide<P>::OTHER>();
+        side.own[0] = (int8_t)goalOf<P>();
+        side.opp[0] = (int8_t)goalOf<PlayerSide<P>::OTHER>();
+        return side;
+    }
+
+    // Fills plays with every distinct legal play for the current player using the given dice and returns how many there are
+    int generatePlays(const int rollDice[], int numDice, PlayList& plays) const
+    {
+        METRIC_TIME(Metric::GENERATE_PLAYS);
+        PlayGenerator generator;
+        generator.side = sideBoard();
+        generator.player = currentPlayer;
+        generator.farthest = farthest[currentPlayer == Player::WHITE ? 0 : 1];
+        generator.race = isRace();
+        generator.generate(rollDice, numDice, plays);
+        return plays.count;
+    }
+
+    // Fills plays with every distinct legal play for the dice (moves) the current player has left
+    int generatePlays(PlayList& plays) const
+    {
+        return generatePlays(dice.diceNums, dice.count, plays);
+    }
+
+    // Adjust dice based on available moves, called before the player enters their move 
+    // Returns false and clears the dice if the player has no valid moves, the turn is then void
+    bool adjustDice()
+    {
+        METRIC_TIME(Metric::ADJUST_DICE);
+        // Find every legal play for the remaining dice, the list is kept per thread because it is too large for the stack
+        static thread_local PlayList plays;
+        generatePlays(plays);
+
+        // If there are no valid moves void the turn
+        if (plays.maxMoves == 0)
+        {
+            dice.clear();
+            return false;
+        }
+
+        // If no legal play starts with dice one the player will have to use dice two first
+        if (!plays.firstDie[dice.diceNums[0]])
+            dice.swap();
+        return true;
+    }
+};
+
+// Single move legality for up to LANES positions at once, for simulators that step many games together. The positions
+// are stored point by point (structure of arrays) as seen by the player to move, the same way as SideBoard, so one
+// SSE2 register holds one point of every position; other builds use plain loops over the lanes. For each position
+// evaluate() finds the points the opponent blocks, whether the player can bear off and, for each of the two dice,
+// every point a piece can move to with that die alone. The rules are those of the move generator
+struct LegalityBatch
+{
+    static const int LANES = 16;
+
+    // own[point][lane] and opp[point][lane] as in SideBoard (25 is the bar, 0 is borne off), and each lane's dice
+    alignas(16) int8_t own[26][LANES];
+    alignas(16) int8_t opp[26][LANES];
+    alignas(16) int8_t dice[2][LANES];
+
+    // Results of evaluate(), points are counted from the player to move's home
+    // blocked: bits 1-24 for points holding two or more of the opponent's pieces
+    // destinations[k]: bit t set if a piece can move to point t using dice k, bit 0 for bearing off
+    uint32_t blocked[LANES];
+    uint32_t destinations[2][LANES];
+    bool bearOff[LANES];
+
+    // Empties every lane, a lane with no pieces has no moves
+    void clear()
+    {
+        std::memset(own, 0, sizeof(own));
+        std::memset(opp, 0, sizeof(opp));
+        std::memset(dice, 0, sizeof(dice));
+    }
+
+    // Puts a position and its roll into a lane
+    void set(int lane, const SideBoard& side, int dieOne, int dieTwo)
+    {
+        for (int point = 0; point <= 25; point++)
+        {
+            own[point][lane] = side.own[point];
+            opp[point][lane] = side.opp[point];
+        }
+        dice[0][lane] = (int8_t)dieOne;
+        dice[1][lane] = (int8_t)dieTwo;
+    }
+
+    void set(int lane, const GameState& state, int dieOne, int dieTwo)
+    {
+        set(lane, state.sideBoard(), dieOne, dieTwo);
+    }
+
+    // Returns true if the position in the lane has a legal play, false if the turn is void
+    bool anyMove(int lane) const
+    {
+        return (destinations[0][lane] | destinations[1][lane]) != 0;
+    }
+
+    // Works out the results for every lane. The dice differ between lanes, so the moves are found for each die value
+    // in all lanes and every lane keeps the ones for its own dice
+    void evaluate()
+    {
+        const ByteLanes none = ByteLanes::fill(0);
+        const ByteLanes one = ByteLanes::fill(1);
+
+        ByteLanes hasOwn[26];
+        ByteLanes blockedAt[25];
+        for (int point = 0; point <= 25; point++)
+            hasOwn[point] = ByteLanes::load(own[point]).greater(none);
+        for (int point = 1; point <= BOARD_SIZE; point++)
+            blockedAt[point] = ByteLanes::load(opp[25 - point]).greater(one);
+        ByteLanes onBar = hasOwn[25];
+
+        // Bearing off needs every piece on the home quadrant
+        ByteLanes outside = none;
+        for (int point = 7; point <= 25; point++)
+            outside = outside | hasOwn[point];
+        ByteLanes canBearOff = outside.equal(none);
+
+        ByteLanes to[2][25];
+        for (int k = 0; k < 2; k++)
+            for (int point = 0; point <= BOARD_SIZE; point++)
+                to[k][point] = none;
+
+        for (int die = 1; die <= 6; die++)
+        {
+            ByteLanes used[2] = { ByteLanes::load(dice[0]).equal(ByteLanes::fill((int8_t)die)),
+                ByteLanes::load(dice[1]).equal(ByteLanes::fill((int8_t)die)) };
+
+            // Pieces on the bar have to be entered before anything else
+            for (int point = 1; point + die <= 25; point++)
+            {
+                ByteLanes legal = hasOwn[point + die].andNot(blockedAt[point]);
+                if (point + die != 25)
+                    legal = legal.andNot(onBar);
+                to[0][point] = to[0][point] | (legal & used[0]);
+                to[1][point] = to[1][point] | (legal & used[1]);
+            }
+
+            // A piece can be borne off from the point equal to the die, or from the farthest point when the die is higher
+            ByteLanes higher = none;
+            ByteLanes lower = none;
+            for (int point = die + 1; point <= 6; point++)
+                higher = higher | hasOwn[point];
+            for (int point = 1; point < die; point++)
+                lower = lower | hasOwn[point];
+            ByteLanes off = canBearOff & (hasOwn[die] | lower.andNot(higher));
+            to[0][0] = to[0][0] | (off & used[0]);
+            to[1][0] = to[1][0] | (off & used[1]);
+        }
+
+        // Turn the lanes of each point back into one mask per position
+        for (int lane = 0; lane < LANES; lane++)
+        {
+            blocked[lane] = 0;
+            destinations[0][lane] = 0;
+            destinations[1][lane] = 0;
+        }
+        for (int point = 0; point <= BOARD_SIZE; point++)
+        {
+            uint32_t blockedLanes = point > 0 ? blockedAt[point].mask() : 0;
+            uint32_t lanes[2] = { to[0][point].mask(), to[1][point].mask() };
+            for (int lane = 0; lane < LANES; lane++)
+            {
+                blocked[lane] |= ((blockedLanes >> lane) & 1) << point;
+                destinations[0][lane] |= ((lanes[0] >> lane) & 1) << point;
+                destinations[1][lane] |= ((lanes[1] >> lane) & 1) << point;
+            }
+        }
+        uint32_t bearOffLanes = canBearOff.mask();
+        for (int lane = 0; lane < LANES; lane++)
+            bearOff[lane] = (bearOffLanes >> lane) & 1;
+    }
+
+    // LANES bytes worked on together, one SSE2 register or a plain array. Comparisons give 0 or -1 in each lane so
+    // they can be combined with & and |
+    struct ByteLanes
+    {
+#if defined(__SSE2__)
+        __m128i value;
+
+        static ByteLanes fill(int8_t x) { return { _mm_set1_epi8(x) }; }
+        static ByteLanes load(const int8_t* from) { return { _mm_load_si128(reinterpret_cast<const __m128i*>(from)) }; }
+        ByteLanes greater(ByteLanes other) const { return { _mm_cmpgt_epi8(value, other.value) }; }
+        ByteLanes equal(ByteLanes other) const { return { _mm_cmpeq_epi8(value, other.value) }; }
+        ByteLanes andNot(ByteLanes other) const { return { _mm_andnot_si128(other.value, value) }; }
+        ByteLanes operator&(ByteLanes other) const { return { _mm_and_si128(value, other.value) }; }
+        ByteLanes operator|(ByteLanes other) const { return { _mm_or_si128(value, other.value) }; }
+        uint32_t mask() const { return (uint32_t)_mm_movemask_epi8(value); }
+#else
+        int8_t value[LANES];
+
+        static ByteLanes fill(int8_t x)
+        {
+            ByteLanes lanes;
+            for (int8_t& v : lanes.value)
+                v = x;
+            return lanes;
+        }
+        static ByteLanes load(const int8_t* from)
+        {
+            ByteLanes lanes;
+            std::memcpy(lanes.value, from, sizeof(lanes.value));
+            return lanes;
+        }
+        ByteLanes greater(ByteLanes other) const
+        {
+            for (int i = 0; i < LANES; i++)
+                other.value[i] = value[i] > other.value[i] ? -1 : 0;
+            return other;
+        }
+        ByteLanes equal(ByteLanes other) const
+        {
+            for (int i = 0; i < LANES; i++)
+                other.value[i] = value[i] == other.value[i] ? -1 : 0;
+            return other;
+        }
+        ByteLanes andNot(ByteLanes other) const
+        {
+            for (int i = 0; i < LANES; i++)
+                other.value[i] = value[i] & ~other.value[i];
+            return other;
+        }
+        ByteLanes operator&(ByteLanes other) const
+        {
+            for (int i = 0; i < LANES; i++)
+                other.value[i] &= value[i];
+            return other;
+        }
+        ByteLanes operator|(ByteLanes other) const
+        {
+            for (int i = 0; i < LANES; i++)
+                other.value[i] |= value[i];
+            return other;
+        }
+        uint32_t mask() const
+        {
+            uint32_t bits = 0;
+            for (int i = 0; i < LANES; i++)
+                bits |= (uint32_t)(value[i] < 0) << i;
+            return bits;
+        }
+#endif
+    };
+};
+
+// Score and cube of a match, or of a money session when the length is 0. Scores and the cube's owner are indexed
+// WHITE = 0 and BLACK = 1, and the owner is -1 while the cube is in the middle
+struct MatchState
+{
+    // Highest cube in money play
+    static constexpr int MAX_CUBE = 64;
+
+    int length = 0;
+    int score[2] = { 0, 0 };
+    int cube = 1;
+    int cubeOwner = -1;
+
+    // The game being played is the Crawford game, in which nobody may double, or comes after it
+    bool crawford = false;
+    bool postCrawford = false;
+
+    // Points "player" still needs to win the match
+    int away(int player) const
+    {
+        return length - score[player];
+    }
+
+    bool over() const
+    {
+        return length > 0 && (score[0] >= length || score[1] >= length);
+    }
+
+    // Returns true if "player" may turn a cube of this value and owner. In a match there is no point in doubling
+    // once the cube already wins the match
+    bool mayDouble(int player, int value, int owner) const
+    {
+        if (crawford || (owner != -1 && owner != player))
+            return false;
+        return length == 0 ? value < MAX_CUBE : value < away(player);
+    }
+
+    bool canDouble(int player) const
+    {
+        return mayDouble(player, cube, cubeOwner);
+    }
+
+    // Doubles the stake, the cube goes to the other player who took it
+    void takeDouble(int player)
+    {
+        cube *= 2;
+        cubeOwner = 1 - player;
+    }
+
+    // Scores a game won by "winner" for "points" times the cube and sets up the next game. The game after the first
+    // one to leave a player one point away is the Crawford game
+    void finishGame(int winner, int points)
+    {
+        score[winner] += points * cube;
+        cube = 1;
+        cubeOwner = -1;
+        if (crawford)
+        {
+            crawford = false;
+            postCrawford = true;
+        }
+        else if (length > 0 && !postCrawford && away(winner) == 1)
+            crawford = true;
+    }
+};
+
+// Interface for a player that chooses its plays without a human at the console
+struct PlayerPolicy
+{
+    virtual ~PlayerPolicy() {}
+
+    // Called before every game with that game's seed so that games can be replayed no matter which thread plays them
+    virtual void reset(uint64_t seed) {}
+
+    // Returns the index of the play to make out of the legal plays for the current player
+    virtual int choosePlay(const GameState& state, const PlayList& plays) = 0;
+
+    // Called while the other side thinks about its moves in state, a bot can use the time to look ahead
+    virtual void ponder(const GameState& state) {}
+
+    // Called once the other side has finished its turn, anything started by ponder stops
+    virtual void stopPondering() {}
+
+    // Returns true to double before rolling, only asked when the match lets the current player double. The default
+    // never doubles
+    virtual bool offerDouble(const GameState& state, const MatchState& match)
+    {
+        return false;
+    }
+
+    // Returns true to take a double offered by the current player of state. The default always takes
+    virtual bool acceptDouble(const GameState& state, const MatchState& match)
+    {
+        return true;
+    }
+};
+
+// Policy that picks any legal play with equal chance
+struct RandomPolicy : PlayerPolicy
+{
+    Xoshiro256 rng;
+
+    void reset(uint64_t seed) override
+    {
+        rng.seed(seed);
+    }
+
+    int choosePlay(const GameState& state, const PlayList& plays) override
+    {
+        return (int)rng.below((uint32_t)plays.count);
+    }
+};
+
+// Policy that picks the play with the best immediate result: fewer pips left, opponent pieces hit, points made
+// and as few lone pieces left open as possible
+struct GreedyPolicy : PlayerPolicy
+{
+    // Copy of the state the plays are tried on, each play is taken back before the next one is made
+    GameState scratch;
+
+    int choosePlay(const GameState& state, const PlayList& plays) override
+    {
+        int best = 0;
+        int bestScore = 0;
+        scratch = state;
+        for (int i = 0; i < plays.count; i++)
+        {
+            MoveUndo undo[4];
+            scratch.applyPlay(plays.plays[i], undo);
+            int score = positionScore(scratch, state.currentPlayer);
+            scratch.undoPlay(undo, plays.plays[i].numMoves);
+            if (i == 0 || score > bestScore)
+            {
+                best = i;
+                bestScore = score;
+            }
+        }
+        return best;
+    }
+
+    // Scores a position for "player", higher is better. The opponent's points and lone pieces count the other way,
+    // so the score for one player is minus the score for the other
+    static int positionScore(const GameState& state, Player player)
+    {
+        int sign = player == Player::WHITE ? -1 : 1;
+        int score = state.pipCount(player == Player::WHITE ? Player::BLACK : Player::WHITE) - state.pipCount(player);
+        for (int i = 0; i < BOARD_SIZE; i++)
+        {
+            int pieces = state.board[i] * sign;
+            if (pieces >= 2)
+                score += 4;
+            else if (pieces == 1)
+                score -= 3;
+            else if (pieces == -1)
+                score += 3;
+            else if (pieces <= -2)
+                score -= 4;
+        }
+        return score;
+    }
+};
+
+// Policy that replays a fixed list of plays, one per turn, given as the moves of each play. If a scripted play
+// is not legal (or the script has run out) the first legal play is made instead
+struct ScriptedPolicy : PlayerPolicy
+{
+    std::vector<std::vector<Move>> script;
+    size_t turn = 0;
+
+    void reset(uint64_t seed) override
+    {
+        turn = 0;
+    }
+
+    int choosePlay(const GameState& state, const PlayList& plays) override
+    {
+        if (turn >= script.size())
+            return 0;
+        const std::vector<Move>& wanted = script[turn++];
+        for (int i = 0; i < plays.count; i++)
+            if (sameMoves(plays.plays[i], wanted))
+                return i;
+        return 0;
+    }
+
+    // Returns true if the play is made of the wanted moves in any order
+    static bool sameMoves(const Play& play, const std::vector<Move>& wanted)
+    {
+        if (play.numMoves != (int)wanted.size())
+            return false;
+        bool used[4] = { false, false, false, false };
+        for (const Move& move : wanted)
+        {
+            bool found = false;
+            for (int i = 0; i < play.numMoves && !found; i++)
+                if (!used[i] && play.moves[i].from == move.from && play.moves[i].to == move.to)
+                {
+                    used[i] = true;
+                    found = true;
+                }
+            if (!found)
+                return false;
+        }
+        return true;
+    }
+};
+
+// Interface for anything that estimates how good a position is
+struct Evaluator
+{
+    virtual ~Evaluator() {}
+
+    // Returns the equity (points expected to be won, between -3 and 3) for the current player, who is about to roll
+    virtual float evaluate(const GameState& state) = 0;
+
+    // Fills values with the equity of each play to the current player, who makes it. Evaluators that can score
+    // many positions in one call override this
+    virtual void evaluatePlays(const GameState& state, const PlayList& plays, float values[]);
+
+    // Fills chances with the cubeless chances for the current player, who is about to roll, of winning, winning a
+    // gammon, winning a backgammon, losing a gammon and losing a backgammon (gammons include backgammons), the same
+    // as the network's outputs. Evaluators that only give an equity have it spread over the results
+    virtual void evaluateChances(const GameState& state, float chances[5]);
+
+    // Fills chances from the chance of winning a race, where gammons and backgammons are not in the estimate
+    static void raceChances(const GameState& state, float winning, float chances[5]);
+};
+
+// Cheap hand-tuned evaluator using the same pip count and point scoring as the greedy policy
+struct HeuristicEvaluator : Evaluator
+{
+    float evaluate(const GameState& state) override
+    {
+        METRIC_TIME(Metric::EVALUATE);
+        // Being on roll is worth about 8 pips
+        return std::tanh((GreedyPolicy::positionScore(state, state.currentPlayer) + 8) / 40.0f);
+    }
+};
+
+// Read-only view of a whole file, memory-mapped where the platform supports it and read into memory otherwise
+class MappedFile
+{
+public:
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+        close();
+    }
+
+    // Maps the file, returns false if it cannot be opened
+    bool open(const std::string& path)
+    {
+        close();
+#ifdef HAVE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0)
+        {
+            ::close(fd);
+            return false;
+        }
+        void* mapped = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED)
+            return false;
+        bytes = static_cast<const uint8_t*>(mapped);
+        length = (size_t)info.st_size;
+#else
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file)
+            return false;
+        std::fseek(file, 0, SEEK_END);
+        long fileSize = std::ftell(file);
+        std::fseek(file, 0, SEEK_SET);
+        buffer.resize(fileSize > 0 ? (size_t)fileSize : 0);
+        bool read = fileSize > 0 && std::fread(buffer.data(), 1, buffer.size(), file) == buffer.size();
+        std::fclose(file);
+        if (!read)
+            return false;
+        bytes = buffer.data();
+        length = buffer.size();
+#endif
+        return true;
+    }
+
+    void close()
+    {
+#ifdef HAVE_MMAP
+        if (bytes)
+            munmap(const_cast<uint8_t*>(bytes), length);
+#else
+        buffer.clear();
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+
+    const uint8_t* data() const
+    {
+        return bytes;
+    }
+
+    size_t size() const
+    {
+        return length;
+    }
+
+private:
+    const uint8_t* bytes = nullptr;
+    size_t length = 0;
+#ifndef HAVE_MMAP
+    std::vector<uint8_t> buffer;
+#endif
+};
+
+// One-sided bearoff database: for every way of placing up to 15 pieces on the six home points, the chance of
+// bearing them all off in exactly 0-31 rolls when always playing to need the fewest rolls on average.
+// The file is a 16 byte header ("BGBO", version, positions, rolls) followed by the average number of rolls
+// for every position as floats and then the chances as 16 bit fractions of 65535, used in place once mapped
+class BearoffDatabase
+{
+public:
+    static const int POINTS = 6;
+    static const int MAX_ROLLS = 32;
+    static const int POSITIONS = 54264;
+
+    // Returns the number of a position from the pieces on points 1-6. Positions are numbered in order of
+    // (pieces on point 1, ..., pieces on point 6, pieces not on the board), so no pieces at all is 0
+    static int index(const int8_t pieces[])
+    {
+        static const IndexTable table;
+        int remaining = NUM_PIECES;
+        int position = 0;
+        for (int point = 0; point < POINTS; point++)
+        {
+            position += table.before[point][remaining][pieces[point]];
+            remaining -= pieces[point];
+        }
+        return position;
+    }
+
+    // Maps the database file, returns false if it is missing or not a database
+    bool open(const std::string& path)
+    {
+        if (!file.open(path))
+            return false;
+        const uint8_t* data = file.data();
+        uint32_t header[4];
+        if (file.size() != fileSize() || std::memcmp(data, "BGBO", 4) != 0)
+        {
+            file.close();
+            return false;
+        }
+        std::memcpy(header, data, sizeof(header));
+        if (header[1] != 1 || header[2] != POSITIONS || header[3] != MAX_ROLLS)
+        {
+            file.close();
+            return false;
+        }
+        means = reinterpret_cast<const float*>(data + 16);
+        chances = reinterpret_cast<const uint16_t*>(data + 16 + POSITIONS * sizeof(float));
+        return true;
+    }
+
+    bool loaded() const
+    {
+        return file.data() != nullptr;
+    }
+
+    // Chance of bearing off position "index" in exactly "rolls" rolls
+    float chance(int index, int rolls) const
+    {
+        return chances[index * MAX_ROLLS + rolls] / 65535.0f;
+    }
+
+    // Average number of rolls needed to bear off position "index"
+    float meanRolls(int index) const
+    {
+        return means[index];
+    }
+
+    // Returns the chance that the player on roll, with position "onRoll", bears off before the other player
+    float winChance(int onRoll, int other) const
+    {
+        // The player on roll wins if they need no more rolls than the other player 
+        float otherNeedsAtLeast = 1.0f;
+        float win = 0;
+        for (int rolls = 0; rolls < MAX_ROLLS; rolls++)
+        {
+            win += chance(onRoll, rolls) * otherNeedsAtLeast;
+            otherNeedsAtLeast -= chance(other, rolls);
+        }
+        return win;
+    }
+
+    // Builds the database and writes it to "path", returns false if the file cannot be written
+    static bool generate(const std::string& path);
+
+    static size_t fileSize()
+    {
+        return 16 + POSITIONS * sizeof(float) + (size_t)POSITIONS * MAX_ROLLS * sizeof(uint16_t);
+    }
+
+private:
+    // before[point][remaining][pieces] is the number of positions that come before putting "pieces" of the
+    // "remaining" pieces on "point"
+    struct IndexTable
+    {
+        int before[POINTS][NUM_PIECES + 1][NUM_PIECES + 1];
+
+        IndexTable()
+        {
+            // ways[n][parts] is the number of ways to split n pieces into that many (possibly empty) parts
+            int ways[NUM_PIECES + 1][POINTS + 2];
+            for (int n = 0; n <= NUM_PIECES; n++)
+                for (int parts = 1; parts <= POINTS + 1; parts++)
+                    ways[n][parts] = parts == 1 ? 1 : 0;
+            for (int parts = 2; parts <= POINTS + 1; parts++)
+                for (int n = 0; n <= NUM_PIECES; n++)
+                    for (int first = 0; first <= n; first++)
+                        ways[n][parts] += ways[n - first][parts - 1];
+
+            for (int point = 0; point < POINTS; point++)
+                for (int remaining = 0; remaining <= NUM_PIECES; remaining++)
+                {
+                    before[point][remaining][0] = 0;
+                    for (int pieces = 1; pieces <= NUM_PIECES; pieces++)
+                        before[point][remaining][pieces] = before[point][remaining][pieces - 1] +
+                            (pieces - 1 <= remaining ? ways[remaining - (pieces - 1)][POINTS - point] : 0);
+                }
+        }
+    };
+
+    MappedFile file;
+    const float* means = nullptr;
+    const uint16_t* chances = nullptr;
+};
+
+// The bearoff database opened at startup, unloaded if there is no database file
+BearoffDatabase bearoffDatabase;
+
+// Evaluator that gives the exact chance of winning once both players have every piece in their home quadrant,
+// from the one-sided bearoff database, and asks another evaluator otherwise. Gammons are not counted in the bearoff
+// equity, the chances for cube decisions add them with the gammon shares while the opponent has nothing off
+struct BearoffEvaluator : Evaluator
+{
+    const BearoffDatabase& database;
+    Evaluator& fallback;
+
+    BearoffEvaluator(const BearoffDatabase& database, Evaluator& fallback)
+        : database(database), fallback(fallback)
+    {
+    }
+
+    float evaluate(const GameState& state) override
+    {
+        if (!database.loaded() || state.farthest[0] > 6 || state.farthest[1] > 6)
+            return fallback.evaluate(state);
+        METRIC_TIME(Metric::EVALUATE);
+        SideBoard side = state.sideBoard();
+        return 2 * database.winChance(BearoffDatabase::index(side.own + 1), BearoffDatabase::index(side.opp + 1)) - 1;
+    }
+
+    // A play can only lead to a bearoff position if the opponent already has every piece home, otherwise the
+    // fallback scores all the plays at once
+    void evaluatePlays(const GameState& state, const PlayList& plays, float values[]) override
+    {
+        if (state.farthest[state.currentPlayer == Player::WHITE ? 1 : 0] > 6)
+        {
+            fallback.evaluatePlays(state, plays, values);
+            return;
+        }
+        Evaluator::evaluatePlays(state, plays, values);
+    }
+
+    void evaluateChances(const GameState& state, float chances[5]) override
+    {
+        if (!database.loaded() || state.farthest[0] > 6 || state.farthest[1] > 6)
+        {
+            fallback.evaluateChances(state, chances);
+            return;
+        }
+        raceChances(state, (evaluate(state) + 1) / 2, chances);
+    }
+};
+
+// Evaluator for races, once no more pieces can be hit, and another evaluator while there is contact. Each side's
+// pip count is raised for the pips it will waste in the bearoff (Keith's count: pieces stacked on the low points and
+// gaps on the high home points), and the chance of winning is taken from a normal distribution of the lead. A roll
+// moves 8.17 pips on average with a spread of 4.3, so over a race of "total" pips between both sides the lead in
+// pips varies by about 1.5 * sqrt(total), and being on roll is worth half a roll. Gammons are not counted in the
+// equity, the chances for cube decisions add them with the gammon shares while the opponent has nothing off
+struct RaceEvaluator : Evaluator
+{
+    Evaluator& fallback;
+
+    explicit RaceEvaluator(Evaluator& fallback)
+        : fallback(fallback)
+    {
+    }
+
+    float evaluate(const GameState& state) override
+    {
+        if (!state.isRace())
+            return fallback.evaluate(state);
+        METRIC_TIME(Metric::EVALUATE);
+        int own = state.currentPlayer == Player::WHITE ? 0 : 1;
+        float ownPips = (float)effectivePips(state, own);
+        float oppPips = (float)effectivePips(state, 1 - own);
+        float lead = oppPips - ownPips + 4.08f;
+        float winChance = 0.5f * std::erfc(-lead / (1.5f * std::sqrt(ownPips + oppPips) * std::sqrt(2.0f)));
+        return 2 * winChance - 1;
+    }
+
+    // Once the game is a race every play leads to a race, which is cheap enough to score one play at a time
+    void evaluatePlays(const GameState& state, const PlayList& plays, float values[]) override
+    {
+        if (state.isRace())
+            Evaluator::evaluatePlays(state, plays, values);
+        else
+            fallback.evaluatePlays(state, plays, values);
+    }
+
+    void evaluateChances(const GameState& state, float chances[5]) override
+    {
+        if (!state.isRace())
+        {
+            fallback.evaluateChances(state, chances);
+            return;
+        }
+        raceChances(state, (evaluate(state) + 1) / 2, chances);
+    }
+
+    // Returns the pip count of "player" (0 for WHITE, 1 for BLACK) plus the pips wasted in the bearoff
+    static int effectivePips(const GameState& state, int player)
+    {
+        int pips = state.pips[player];
+        int low[4] = { 0, state.piecesAt(player, 1), state.piecesAt(player, 2), state.piecesAt(player, 3) };
+        pips += 2 * std::max(low[1] - 1, 0) + std::max(low[2] - 1, 0) + std::max(low[3] - 3, 0);
+        for (int point = 4; point <= 6; point++)
+            if (state.piecesAt(player, point) == 0)
+                pips++;
+        return pips;
+    }
+};
+
+// Neural network in the style of TD-Gammon: 198 inputs describing the position for the player to move, one hidden
+// layer and five outputs (chances of winning, winning a gammon, winning a backgammon, losing a gammon and losing
+// a backgammon). Positions are run through it in batches stored input by input (structure of arrays), so the
+// AVX2 or SSE kernel works on several positions at once; other builds use the plain loop
+struct NeuralNetwork
+{
+    static const int INPUTS = 198;
+    static const int OUTPUTS = 5;
+
+    // Batches are padded to a multiple of this many positions
+    static const int BATCH_LANES = 8;
+
+    int hidden = 0;
+    bool loaded = false;
+
+    // hiddenWeights[h * INPUTS + i] and outputWeights[k * hidden + h] 
+    std::vector<float> hiddenWeights;
+    std::vector<float> hiddenBias;
+    std::vector<float> outputWeights;
+    std::vector<float> outputBias;
+
+    // Sets up a network with small random weights
+    void initialize(int hiddenUnits, uint64_t seed)
+    {
+        hidden = hiddenUnits;
+        Xoshiro256 rng(seed);
+        std::uniform_real_distribution<float> weight(-0.1f, 0.1f);
+        hiddenWeights.resize((size_t)hidden * INPUTS);
+        hiddenBias.resize(hidden);
+        outputWeights.resize((size_t)OUTPUTS * hidden);
+        outputBias.resize(OUTPUTS);
+        for (float& w : hiddenWeights)
+            w = weight(rng);
+        for (float& w : hiddenBias)
+            w = weight(rng);
+        for (float& w : outputWeights)
+            w = weight(rng);
+        for (float& w : outputBias)
+            w = weight(rng);
+    }
+
+    // Writes the inputs for a position, seen from the player to move (own) against the opponent (opp), with
+    // input i at inputs[i * stride]: four inputs per point for each player, then their bar and borne off pieces
+    static void encode(const int8_t own[], const int8_t opp[], float* inputs, int stride)
+    {
+        const int8_t* players[2] = { own, opp };
+        for (int player = 0; player < 2; player++)
+        {
+            float* base = inputs + (size_t)player * 96 * stride;
+            for (int point = 1; point <= BOARD_SIZE; point++)
+            {
+                int pieces = players[player][point];
+                float* unit = base + (size_t)(point - 1) * 4 * stride;
+                unit[0] = pieces >= 1 ? 1.0f : 0.0f;
+                unit[stride] = pieces >= 2 ? 1.0f : 0.0f;
+                unit[2 * stride] = pieces >= 3 ? 1.0f : 0.0f;
+                unit[3 * stride] = pieces > 3 ? (pieces - 3) / 2.0f : 0.0f;
+            }
+            inputs[(size_t)(192 + player) * stride] = players[player][25] / 2.0f;
+            inputs[(size_t)(194 + player) * stride] = players[player][0] / (float)NUM_PIECES;
+        }
+        // The last two inputs say whose turn it is, always the first player here
+        inputs[(size_t)196 * stride] = 1.0f;
+        inputs[(size_t)197 * stride] = 0.0f;
+    }
+
+    // Runs "count" positions through the network. Input i of position b is at inputs[i * stride + b] and output k
+    // goes to outputs[k * stride + b]; hiddenOut receives the hidden layer the same way. stride must be a
+    // multiple of BATCH_LANES and at least count
+    void forward(const float* inputs, int stride, int count, float* hiddenOut, float* outputs) const
+    {
+        for (int first = 0; first < count; first += BATCH_LANES)
+        {
+            layer(inputs, INPUTS, hiddenWeights.data(), hiddenBias.data(), hidden, stride, first, hiddenOut);
+            layer(hiddenOut, hidden, outputWeights.data(), outputBias.data(), OUTPUTS, stride, first, outputs);
+        }
+    }
+
+    // Returns the equity for the player to move from the five outputs
+    static float equity(const float outputs[], int stride)
+    {
+        return 2 * outputs[0] - 1 + outputs[stride] - outputs[3 * stride] + outputs[2 * stride] - outputs[4 * stride];
+    }
+
+    static float sigmoid(float x)
+    {
+        return 1.0f / (1.0f + std::exp(-x));
+    }
+
+    // Computes one fully connected sigmoid layer for the BATCH_LANES positions starting at "first". Four outputs
+    // are worked on at once so the multiply-adds for one output do not wait on each other
+    static void layer(const float* in, int numIn, const float* weights, const float* bias, int numOut, int stride, int first, float* out)
+    {
+        int o = 0;
+        for (; o + 4 <= numOut; o += 4)
+        {
+            const float* w = weights + (size_t)o * numIn;
+            Lanes sum0 = Lanes::fill(bias[o]);
+            Lanes sum1 = Lanes::fill(bias[o + 1]);
+            Lanes sum2 = Lanes::fill(bias[o + 2]);
+            Lanes sum3 = Lanes::fill(bias[o + 3]);
+            for (int i = 0; i < numIn; i++)
+            {
+                Lanes x = Lanes::load(in + (size_t)i * stride + first);
+                sum0 = Lanes::multiplyAdd(Lanes::fill(w[i]), x, sum0);
+                sum1 = Lanes::multiplyAdd(Lanes::fill(w[numIn + i]), x, sum1);
+                sum2 = Lanes::multiplyAdd(Lanes::fill(w[2 * numIn + i]), x, sum2);
+                sum3 = Lanes::multiplyAdd(Lanes::fill(w[3 * numIn + i]), x, sum3);
+            }
+            sum0.store(out + (size_t)o * stride + first);
+            sum1.store(out + (size_t)(o + 1) * stride + first);
+            sum2.store(out + (size_t)(o + 2) * stride + first);
+            sum3.store(out + (size_t)(o + 3) * stride + first);
+        }
+        for (; o < numOut; o++)
+        {
+            const float* w = weights + (size_t)o * numIn;
+            Lanes sum = Lanes::fill(bias[o]);
+            for (int i = 0; i < numIn; i++)
+                sum = Lanes::multiplyAdd(Lanes::fill(w[i]), Lanes::load(in + (size_t)i * stride + first), sum);
+            sum.store(out + (size_t)o * stride + first);
+        }
+        for (o = 0; o < numOut; o++)
+        {
+            float* result = out + (size_t)o * stride + first;
+            for (int b = 0; b < BATCH_LANES; b++)
+                result[b] = sigmoid(result[b]);
+        }
+    }
+
+    // BATCH_LANES floats worked on together: one AVX2 register, two SSE registers or a plain array
+    struct Lanes
+    {
+#if defined(__AVX2__) && defined(__FMA__)
+        __m256 value;
+
+        static Lanes fill(float x) { return { _mm256_set1_ps(x) }; }
+        static Lanes load(const float* from) { return { _mm256_loadu_ps(from) }; }
+        static Lanes multiplyAdd(Lanes a, Lanes b, Lanes c) { return { _mm256_fmadd_ps(a.value, b.value, c.value) }; }
+        void store(float* to) const { _mm256_storeu_ps(to, value); }
+#elif defined(__SSE2__)
+        __m128 low, high;
+
+        static Lanes fill(float x) { return { _mm_set1_ps(x), _mm_set1_ps(x) }; }
+        static Lanes load(const float* from) { return { _mm_loadu_ps(from), _mm_loadu_ps(from + 4) }; }
+        static Lanes multiplyAdd(Lanes a, Lanes b, Lanes c)
+        {
+            return { _mm_add_ps(_mm_mul_ps(a.low, b.low), c.low), _mm_add_ps(_mm_mul_ps(a.high, b.high), c.high) };
+        }
+        void store(float* to) const
+        {
+            _mm_storeu_ps(to, low);
+            _mm_storeu_ps(to + 4, high);
+        }
+#else
+        float value[BATCH_LANES];
+
+        static Lanes fill(float x)
+        {
+            Lanes lanes;
+            for (float& v : lanes.value)
+                v = x;
+            return lanes;
+        }
+        static Lanes load(const float* from)
+        {
+            Lanes lanes;
+            std::memcpy(lanes.value, from, sizeof(lanes.value));
+            return lanes;
+        }
+        static Lanes multiplyAdd(Lanes a, Lanes b, Lanes c)
+        {
+            for (int i = 0; i < BATCH_LANES; i++)
+                c.value[i] += a.value[i] * b.value[i];
+            return c;
+        }
+        void store(float* to) const
+        {
+            std::memcpy(to, value, sizeof(value));
+        }
+#endif
+    };
+
+    // Saves the weights as "BGNN", version, inputs, hidden units and outputs followed by every weight as a float
+    bool save(const std::string& path) const
+    {
+        FILE* file = std::fopen(path.c_str(), "wb");
+        if (!file)
+            return false;
+        uint32_t header[5] = { 0, 1, INPUTS, (uint32_t)hidden, OUTPUTS };
+        std::memcpy(header, "BGNN", 4);
+        bool written = std::fwrite(header, sizeof(header), 1, file) == 1 &&
+            std::fwrite(hiddenWeights.data(), sizeof(float), hiddenWeights.size(), file) == hiddenWeights.size() &&
+            std::fwrite(hiddenBias.data(), sizeof(float), hiddenBias.size(), file) == hiddenBias.size() &&
+            std::fwrite(outputWeights.data(), sizeof(float), outputWeights.size(), file) == outputWeights.size() &&
+            std::fwrite(outputBias.data(), sizeof(float), outputBias.size(), file) == outputBias.size();
+        return std::fclose(file) == 0 && written;
+    }
+
+    // Loads weights saved by save(), returns false (leaving the network as it was) if the file is not valid
+    bool load(const std::string& path)
+    {
+        MappedFile file;
+        if (!file.open(path) || file.size() < 20 || std::memcmp(file.data(), "BGNN", 4) != 0)
+            return false;
+        uint32_t header[5];
+        std::memcpy(header, file.data(), sizeof(header));
+        size_t units = header[3];
+        if (header[1] != 1 || header[2] != INPUTS || header[4] != OUTPUTS || units == 0 ||
+            file.size() != sizeof(header) + sizeof(float) * (units * INPUTS + units + OUTPUTS * units + OUTPUTS))
+            return false;
+        hidden = (int)units;
+        const float* weights = reinterpret_cast<const float*>(file.data() + sizeof(header));
+        hiddenWeights.assign(weights, weights + units * INPUTS);
+        weights += units * INPUTS;
+        hiddenBias.assign(weights, weights + units);
+        weights += units;
+        outputWeights.assign(weights, weights + OUTPUTS * units);
+        weights += OUTPUTS * units;
+        outputBias.assign(weights, weights + OUTPUTS);
+        loaded = true;
+        return true;
+    }
+};
+
+// The network loaded at startup from weights.bin, untrained (and unused by the bots) if there is no such file
+NeuralNetwork neuralNetwork;
+
+// Evaluator that runs positions through a neural network, scoring every play for a roll in one batch.
+// Scratch space is kept per thread so one evaluator can be shared by many threads
+struct NeuralEvaluator : Evaluator
+{
+    const NeuralNetwork& network;
+
+    explicit NeuralEvaluator(const NeuralNetwork& network)
+        : network(network)
+    {
+    }
+
+    float evaluate(const GameState& state) override
+    {
+        METRIC_TIME(Metric::EVALUATE);
+        Scratch& scratch = scratchSpace(1);
+        SideBoard side = state.sideBoard();
+        NeuralNetwork::encode(side.own, side.opp, scratch.inputs.data(), scratch.stride);
+        network.forward(scratch.inputs.data(), scratch.stride, 1, scratch.hidden.data(), scratch.outputs.data());
+        return NeuralNetwork::equity(scratch.outputs.data(), scratch.stride);
+    }
+
+    void evaluatePlays(const GameState& state, const PlayList& plays, float values[]) override
+    {
+        METRIC_TIME(Metric::EVALUATE_BATCH);
+        Scratch& scratch = scratchSpace(plays.count);
+        SideBoard start = state.sideBoard();
+
+        // Encode the position after every play from the opponent's side, finished games are scored directly 
+        for (int i = 0; i < plays.count; i++)
+        {
+            SideBoard side = start;
+            side.applyPlay(plays.plays[i], state.currentPlayer);
+            values[i] = side.own[0] == NUM_PIECES ? (float)side.winPoints() : UNSET;
+            NeuralNetwork::encode(side.opp, side.own, scratch.inputs.data() + i, scratch.stride);
+        }
+        network.forward(scratch.inputs.data(), scratch.stride, plays.count, scratch.hidden.data(), scratch.outputs.data());
+        for (int i = 0; i < plays.count; i++)
+            if (values[i] == UNSET)
+                values[i] = -NeuralNetwork::equity(scratch.outputs.data() + i, scratch.stride);
+    }
+
+    void evaluateChances(const GameState& state, float chances[5]) override
+    {
+        METRIC_TIME(Metric::EVALUATE);
+        Scratch& scratch = scratchSpace(1);
+        SideBoard side = state.sideBoard();
+        NeuralNetwork::encode(side.own, side.opp, scratch.inputs.data(), scratch.stride);
+        network.forward(scratch.inputs.data(), scratch.stride, 1, scratch.hidden.data(), scratch.outputs.data());
+        for (int i = 0; i < 5; i++)
+            chances[i] = scratch.outputs[(size_t)i * scratch.stride];
+    }
+
+private:
+    static constexpr float UNSET = -1000.0f;
+
+    // Inputs, hidden layer and outputs for a batch, sized for the largest batch seen so far on this thread
+    struct Scratch
+    {
+        int stride = 0;
+        std::vector<float> inputs;
+        std::vector<float> hidden;
+        std::vector<float> outputs;
+    };
+
+    Scratch& scratchSpace(int count)
+    {
+        static thread_local Scratch scratch;
+        int stride = (count + NeuralNetwork::BATCH_LANES - 1) / NeuralNetwork::BATCH_LANES * NeuralNetwork::BATCH_LANES;
+        if (stride > scratch.stride || (size_t)network.hidden * stride > scratch.hidden.size())
+        {
+            scratch.stride = std::max(stride, scratch.stride);
+            scratch.inputs.assign((size_t)NeuralNetwork::INPUTS * scratch.stride, 0.0f);
+            scratch.hidden.assign((size_t)network.hidden * scratch.stride, 0.0f);
+            scratch.outputs.assign((size_t)NeuralNetwork::OUTPUTS * scratch.stride, 0.0f);
+        }
+        return scratch;
+    }
+};
+
+// Policy that makes the play its evaluator likes best, one ply deep
+struct EvaluatorPolicy : PlayerPolicy
+{
+    Evaluator& evaluator;
+    float values[MAX_PLAYS];
+
+    explicit EvaluatorPolicy(Evaluator& evaluator)
+        : evaluator(evaluator)
+    {
+    }
+
+    int choosePlay(const GameState& state, const PlayList& plays) override
+    {
+        evaluator.evaluatePlays(state, plays, values);
+        return (int)(std::max_element(values, values + plays.count) - values);
+    }
+
+    bool offerDouble(const GameState& state, const MatchState& match) override;
+    bool acceptDouble(const GameState& state, const MatchState& match) override;
+};
+
+// The 21 distinct rolls, doubles come up 1 time in 36 and the others 2 times in 36
+struct RollTable
+{
+    int dice[21][2];
+    float probability[21];
+
+    RollTable()
+    {
+        int roll = 0;
+        for (int dieOne = 1; dieOne <= 6; dieOne++)
+            for (int dieTwo = dieOne; dieTwo <= 6; dieTwo++, roll++)
+            {
+                dice[roll][0] = dieOne;
+                dice[roll][1] = dieTwo;
+                probability[roll] = dieOne == dieTwo ? 1.0f / 36 : 2.0f / 36;
+            }
+    }
+
+    // Fills rollDice with the moves for a roll (four for doubles) and returns how many there are
+    int moves(int roll, int rollDice[4]) const
+    {
+        rollDice[0] = rollDice[2] = rollDice[3] = dice[roll][0];
+        rollDice[1] = dice[roll][1];
+        return dice[roll][0] == dice[roll][1] ? 4 : 2;
+    }
+};
+
+const RollTable ROLLS;
+
+// Opening book: the best play for every roll in the positions reached over the first few plies when both players
+// follow the book. Entries are found through a minimal perfect hash (hash and displace) over the packed position
+// key and the roll: the hash picks a bucket, the bucket's displacement picks the entry, and the key stored in the
+// entry tells positions in the book from those that are not. The file is a 16 byte header ("BGOB", version, entries,
+// buckets), a 32 bit displacement per bucket and then the 16 byte entries, used in place once mapped
+class OpeningBook
+{
+public:
+    // Position key, roll (0-20 in the order of ROLLS), number of moves and each move as point | (die << 5), with points
+    // counted from the mover's home and 25 for the bar
+    struct Entry
+    {
+        uint8_t key[10];
+        uint8_t roll;
+        uint8_t numMoves;
+        uint8_t moves[4];
+    };
+
+    // Maps the book file, returns false if it is missing or not a book
+    bool open(const std::string& path)
+    {
+        if (!file.open(path))
+            return false;
+        uint32_t header[4];
+        if (file.size() < sizeof(header) || std::memcmp(file.data(), "BGOB", 4) != 0)
+        {
+            file.close();
+            return false;
+        }
+        std::memcpy(header, file.data(), sizeof(header));
+        if (header[1] != 1 || header[2] == 0 || header[3] == 0 ||
+            file.size() != sizeof(header) + header[3] * sizeof(uint32_t) + header[2] * sizeof(Entry))
+        {
+            file.close();
+            return false;
+        }
+        numEntries = header[2];
+        numBuckets = header[3];
+        displacements = reinterpret_cast<const uint32_t*>(file.data() + sizeof(header));
+        entries = reinterpret_cast<const Entry*>(file.data() + sizeof(header) + numBuckets * sizeof(uint32_t));
+        return true;
+    }
+
+    bool loaded() const
+    {
+        return file.data() != nullptr;
+    }
+
+    uint32_t size() const
+    {
+        return loaded() ? numEntries : 0;
+    }
+
+    // Returns the index in plays of the book play for the current player and the roll in state.dice, or -1 if the
+    // position is not in the book or the dice have already been partly used
+    int find(const GameState& state, const PlayList& plays) const
+    {
+        const diceRoll& dice = state.dice;
+        if (!loaded() || !(dice.count == 4 || (dice.count == 2 && dice.diceNums[0] != dice.diceNums[1])))
+            return -1;
+        int roll = rollIndex(dice.diceNums[0], dice.diceNums[1]);
+        PositionKey key = state.positionKey();
+        uint64_t hash = keyHash(key, roll);
+        const Entry& entry = entries[slot(hash, displacements[bucket(hash, numBuckets)], numEntries)];
+        if (std::memcmp(entry.key, key.data, sizeof(entry.key)) != 0 || entry.roll != roll)
+            return -1;
+
+        // The play is matched on the position it leads to, so the order of its moves does not matter
+        SideBoard start = state.sideBoard();
+        SideBoard target = start;
+        target.applyPlay(decode(entry, state.currentPlayer), state.currentPlayer);
+        for (int i = 0; i < plays.count; i++)
+        {
+            SideBoard side = start;
+            side.applyPlay(plays.plays[i], state.currentPlayer);
+            if (std::memcmp(&side, &target, sizeof(side)) == 0)
+                return i;
+        }
+        return -1;
+    }
+
+    // Returns the number of a roll in ROLLS, whichever order the dice are in
+    static int rollIndex(int dieOne, int dieTwo)
+    {
+        int low = std::min(dieOne, dieTwo);
+        int high = std::max(dieOne, dieTwo);
+        int roll = 0;
+        while (ROLLS.dice[roll][0] != low || ROLLS.dice[roll][1] != high)
+            roll++;
+        return roll;
+    }
+
+    static uint64_t keyHash(const PositionKey& key, int roll)
+    {
+        uint64_t words[2] = {};
+        std::memcpy(words, key.data, sizeof(key.data));
+        words[1] |= (uint64_t)roll << 16;
+        uint64_t state = words[0];
+        uint64_t hash = Xoshiro256::splitMix(state);
+        state ^= words[1];
+        return hash ^ Xoshiro256::splitMix(state);
+    }
+
+    static uint32_t bucket(uint64_t hash, uint32_t buckets)
+    {
+        return (uint32_t)((hash >> 32) % buckets);
+    }
+
+    static uint32_t slot(uint64_t hash, uint32_t displacement, uint32_t entries)
+    {
+        uint64_t state = hash ^ (displacement * 0xD6E8FEB86659FD93ULL);
+        return (uint32_t)(Xoshiro256::splitMix(state) % entries);
+    }
+
+    // Writes a book from entries with distinct keys and rolls, returns false if the file cannot be written
+    static bool write(const std::string& path, const std::vector<Entry>& entries);
+
+    // Builds a book of "plies" plies by rolling out the most promising plays for every roll, see its definition
+    static bool generate(const std::string& path, int plies, long trials, int threads);
+
+private:
+    // Turns an entry's moves back into a play for "player"
+    static Play decode(const Entry& entry, Player player)
+    {
+        Play play;
+        play.numMoves = entry.numMoves;
+        for (int i = 0; i < entry.numMoves; i++)
+        {
+            int from = entry.moves[i] & 31;
+            int die = entry.moves[i] >> 5;
+            int to = from - die;
+            play.moves[i].from = from == 25 ? -1 : (player == Player::WHITE ? from - 1 : BOARD_SIZE - from);
+            play.moves[i].to = to <= 0 ? 24 : (player == Player::WHITE ? to - 1 : BOARD_SIZE - to);
+            play.dice[i] = die;
+        }
+        return play;
+    }
+
+    MappedFile file;
+    uint32_t numEntries = 0;
+    uint32_t numBuckets = 0;
+    const uint32_t* displacements = nullptr;
+    const Entry* entries = nullptr;
+};
+
+// The opening book opened at startup, unloaded if there is no book file
+OpeningBook openingBook;
+
+// Match equity table: the chance of winning the match for a player who needs "away" more points against one who
+// needs "oppAway", worked out by dynamic programming back from the end of the match. Every game is won by either
+// side equally often with a fixed share of the wins being gammons and backgammons. The cube is not counted before
+// the Crawford game, and after it the trailer doubles at once. The file is a 24 byte header ("BGMT", version, largest
+// away, 0, then the gammon and backgammon shares as floats) followed by the table before the Crawford game
+// ((MAX_AWAY + 1)^2 floats) and after it (MAX_AWAY + 1 floats, for the trailer), used in place once mapped
+class MatchEquityTable
+{
+public:
+    static constexpr int MAX_AWAY = 25;
+
+    // Share of the wins that are gammons (backgammons included) and backgammons
+    static constexpr float GAMMON_SHARE = 0.25f;
+    static constexpr float BACKGAMMON_SHARE = 0.01f;
+
+    // Maps the table from "path", working it out and writing it there first if the file is missing or was made with
+    // other settings. Returns false if the table could not be written and is only kept in memory
+    bool open(const std::string& path);
+
+    // Chance of winning the match for a player "away" points from winning against one "oppAway" points away, in
+    // the games after the Crawford game if postCrawford is set. Longer matches are counted as MAX_AWAY away
+    float equity(int away, int oppAway, bool postCrawford) const
+    {
+        if (away <= 0)
+            return 1;
+        if (oppAway <= 0)
+            return 0;
+        away = std::min(away, MAX_AWAY);
+        oppAway = std::min(oppAway, MAX_AWAY);
+        if (postCrawford && (away == 1) != (oppAway == 1))
+            return away == 1 ? 1 - post[oppAway] : post[away];
+        return pre[away * (MAX_AWAY + 1) + oppAway];
+    }
+
+    bool loaded() const
+    {
+        return pre != nullptr;
+    }
+
+private:
+    static constexpr int HEADER_SIZE = 24;
+    static constexpr int ENTRIES = (MAX_AWAY + 1) * (MAX_AWAY + 2);
+
+    bool map(const std::string& path);
+    static void compute(float pre[], float post[]);
+
+    MappedFile file;
+    std::vector<float> memory;
+    const float* pre = nullptr;
+    const float* post = nullptr;
+};
+
+// The match equity table, opened (and made if need be) at startup
+MatchEquityTable matchEquityTable;
+
+// Cubeful equity from cubeless chances without any search (Janowski): the value with the cube is a mix of the value
+// with a dead cube and with a perfectly efficient live cube, which is turned and passed exactly at the take points.
+// Values are chances of winning the match, or points in money play. Take points are found on the value after the
+// double, which looks one cube level further ahead until the depth runs out and the cube is counted as dead. The
+// chances of gammons and backgammons are kept as fixed shares of the wins and losses as the chance of winning varies
+struct CubeModel
+{
+    // Share of the live cube's extra value that is really won, and the cube levels looked ahead
+    static constexpr float EFFICIENCY = 0.68f;
+    static constexpr int DEPTH = 2;
+
+    const MatchState& match;
+    int player;
+    bool postCrawford;
+    float win[3];
+    float lose[3];
+
+    // The values are for "player" (0 for WHITE, 1 for BLACK), who is on roll with these chances
+    CubeModel(const MatchState& match, int player, const float chances[5])
+        : match(match), player(player), postCrawford(match.crawford || match.postCrawford)
+    {
+        float winning = chances[0];
+        float losing = 1 - chances[0];
+        win[2] = winning > 1e-6f ? chances[2] / winning : 0;
+        win[1] = winning > 1e-6f ? chances[1] / winning - win[2] : 0;
+        win[0] = 1 - win[1] - win[2];
+        lose[2] = losing > 1e-6f ? chances[4] / losing : 0;
+        lose[1] = losing > 1e-6f ? chances[3] / losing - lose[2] : 0;
+        lose[0] = 1 - lose[1] - lose[2];
+    }
+
+    // Value of the player winning "points" (losing if negative) at the end of this game
+    float value(int points) const
+    {
+        if (match.length == 0)
+            return (float)points;
+        int away = match.away(player);
+        int oppAway = match.away(1 - player);
+        return points > 0 ? matchEquityTable.equity(away - points, oppAway, postCrawford) : matchEquityTable.equity(away, oppAway + points, postCrawford);
+    }
+
+    // Average value of the games the player wins or loses with the cube at "cube"
+    float winValue(int cube) const
+    {
+        return win[0] * value(cube) + win[1] * value(2 * cube) + win[2] * value(3 * cube);
+    }
+
+    float loseValue(int cube) const
+    {
+        return lose[0] * value(-cube) + lose[1] * value(-2 * cube) + lose[2] * value(-3 * cube);
+    }
+
+    float dead(float winning, int cube) const
+    {
+        return winning * winValue(cube) + (1 - winning) * loseValue(cube);
+    }
+
+    // Value with the chance of winning "winning" and the cube at "cube" held by "owner" (-1 in the middle)
+    float cubeful(float winning, int cube, int owner, int depth) const
+    {
+        float deadValue = dead(winning, cube);
+        bool mine = match.mayDouble(player, cube, owner);
+        bool theirs = match.mayDouble(1 - player, cube, owner);
+        if (depth == 0 || (!mine && !theirs))
+            return deadValue;
+
+        // Below the player's take point the other side doubles them out, above the other side's the player cashes
+        float lowChance = 0;
+        float lowValue = loseValue(cube);
+        float highChance = 1;
+        float highValue = winValue(cube);
+        if (theirs)
+        {
+            lowValue = value(-cube);
+            lowChance = takePoint(2 * cube, player, lowValue, depth - 1);
+        }
+        if (mine)
+        {
+            highValue = value(cube);
+            highChance = takePoint(2 * cube, 1 - player, highValue, depth - 1);
+        }
+        float live = winning <= lowChance ? lowValue : winning >= highChance ? highValue
+            : lowValue + (winning - lowChance) / (highChance - lowChance) * (highValue - lowValue);
+        return EFFICIENCY * live + (1 - EFFICIENCY) * deadValue;
+    }
+
+    // Returns the chance of winning at which the value with the cube at "cube" held by "owner" is "target". With a
+    // dead cube the value is a straight line, otherwise the chance is found by bisection since the value only rises
+    float takePoint(int cube, int owner, float target, int depth) const
+    {
+        if (depth == 0)
+        {
+            float low = loseValue(cube);
+            float high = winValue(cube);
+            return high > low ? std::min(std::max((target - low) / (high - low), 0.0f), 1.0f) : 0.5f;
+        }
+        float low = 0;
+        float high = 1;
+        if (cubeful(low, cube, owner, depth) >= target)
+            return 0;
+        if (cubeful(high, cube, owner, depth) <= target)
+            return 1;
+        for (int i = 0; i < 14; i++)
+        {
+            float middle = (low + high) / 2;
+            if (cubeful(middle, cube, owner, depth) < target)
+                low = middle;
+            else
+                high = middle;
+        }
+        return (low + high) / 2;
+    }
+};
+
+// Values for the player on roll of not doubling, doubling and being taken, and doubling and being passed
+struct CubeDecision
+{
+    float noDouble = 0;
+    float doubleTake = 0;
+    float doublePass = 0;
+
+    bool shouldDouble() const
+    {
+        return std::min(doubleTake, doublePass) > noDouble;
+    }
+
+    // Whether the other player should take, which is when taking leaves the doubler no better off than a pass
+    bool shouldTake() const
+    {
+        return doubleTake <= doublePass;
+    }
+};
+
+// Results of a search
+struct SearchResult
+{
+    // Index of the best play in the list searched and its equity
+    int bestPlay = 0;
+    float value = 0;
+
+    // Deepest search (in plies) that was finished and the nodes visited in total
+    int depth = 0;
+    long nodes = 0;
+    double seconds = 0;
+};
+
+// Expectiminimax search that chooses a play for the current player, taking the average over the 21 rolls at chance
+// nodes with Star1/Star2 pruning. Plays are ordered by their static evaluation and the search deepens one ply at a time
+// until the depth limit or the time budget is reached
+class SearchEngine
+{
+public:
+    // Lowest and highest equity any position can have (losing or winning a backgammon)
+    static constexpr float LOWEST = -3.0f;
+    static constexpr float HIGHEST = 3.0f;
+
+    // Nodes visited between checks of the clock
+    static constexpr long CHECK_NODES = 1024;
+
+    SearchEngine(Evaluator& evaluator, TranspositionTable& table);
+
+    // Searches the plays for the roll in state.dice, a time budget of 0 or less only stops at maxDepth 
+    SearchResult search(const GameState& state, const PlayList& plays, int maxDepth, double seconds, bool verbose = false);
+
+    // Fills values with the equity of every play, each searched to "depth" plies with the full window so that all
+    // of them are exact and can be ranked. Returns the nodes visited
+    long evaluatePlays(const GameState& state, const PlayList& plays, int depth, float values[]);
+
+    // Stops a search running on another thread the next time it checks the clock, and every search after it until
+    // resume is called
+    void cancel()
+    {
+        cancelled.store(true, std::memory_order_relaxed);
+    }
+
+    void resume()
+    {
+        cancelled.store(false, std::memory_order_relaxed);
+    }
+
+    bool isCancelled() const
+    {
+        return cancelled.load(std::memory_order_relaxed);
+    }
+
+private:
+    // Lists and scratch space for one ply of the search, kept so the search does not allocate
+    struct Ply
+    {
+        PlayList plays;
+        float score[MAX_PLAYS];
+        int order[MAX_PLAYS];
+    };
+
+    // The search makes and takes back plays on a single copy of the position instead of copying it at every node
+    float chanceNode(GameState& state, int depth, float alpha, float beta);
+    float maxNode(GameState& state, int roll, int depth, float alpha, float beta, bool probeOnly);
+    float childValue(GameState& state, const Play& play, int depth, float alpha, float beta);
+    int orderPlays(Ply& ply, const GameState& state);
+    bool timeUp();
+
+    Evaluator& evaluator;
+    TranspositionTable& table;
+    std::vector<std::unique_ptr<Ply>> plies;
+    long nodes;
+    long nextCheck;
+    bool stopped;
+    bool timed;
+    std::chrono::steady_clock::time_point deadline;
+    std::atomic<bool> cancelled;
+};
+
+// Searches the bot's replies on a background thread while the other side is thinking. The other side's plays are
+// taken best first by the bot's evaluator and for each of them every roll the bot could get is searched with the
+// bot's own depth and time budget. The best reply to each is kept by the position it leads to, and the bot's
+// transposition table, which the search shares, keeps everything else that was found
+class Ponderer
+{
+public:
+    Ponderer(Evaluator& evaluator, TranspositionTable& table, int maxDepth, double seconds)
+        : evaluator(evaluator), engine(evaluator, table), maxDepth(maxDepth), seconds(seconds)
+    {
+    }
+
+    ~Ponderer()
+    {
+        stop();
+    }
+
+    // Stops pondering on the last position and starts on this one, where the other side is about to move
+    void start(const GameState& state);
+
+    // Cancels the search and waits for the thread to finish, the replies found so far are kept
+    void stop();
+
+    // Returns the index of the reply found for this position and roll, or -1 if it was not pondered to the end
+    int find(const GameState& state, const PlayList& plays);
+
+    // Forgets the replies, called once the bot has played
+    void clear()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        replies.clear();
+    }
+
+private:
+    void run(GameState state);
+
+    // Replies are stored by the position's hash mixed with the roll
+    static uint64_t replyKey(uint64_t hash, int roll)
+    {
+        return hash ^ ((uint64_t)(roll + 1) * 0x9E3779B97F4A7C15ULL);
+    }
+
+    Evaluator& evaluator;
+    SearchEngine engine;
+    int maxDepth;
+    double seconds;
+    std::thread thread;
+    std::mutex lock;
+    std::unordered_map<uint64_t, uint64_t> replies;
+    PlayList plays;
+    PlayList answers;
+};
+
+// Policy that searches for the best play within a depth limit and a time budget. Once the game is a race it makes
+// the play the race evaluator likes best without searching
+struct SearchPolicy : PlayerPolicy
+{
+    HeuristicEvaluator heuristic;
+    NeuralEvaluator neural;
+    RaceEvaluator race;
+    BearoffEvaluator evaluator;
+    TranspositionTable table;
+    SearchEngine engine;
+    int maxDepth;
+    double seconds;
+    bool verbose;
+    float values[MAX_PLAYS];
+
+    // Made the first time the bot is asked to ponder, so bots that never ponder do not carry one
+    std::unique_ptr<Ponderer> ponderer;
+
+    SearchPolicy(int maxDepth, double seconds, bool verbose = false, int tableBits = 20)
+        : neural(neuralNetwork), race(neuralNetwork.loaded ? (Evaluator&)neural : heuristic), evaluator(bearoffDatabase, race), table(tableBits), engine(evaluator, table), maxDepth(maxDepth), seconds(seconds), verbose(verbose)
+    {
+    }
+
+    // Stored results from earlier games are dropped so that a game plays the same however many were played before it
+    void reset(uint64_t seed) override
+    {
+        table.clear();
+    }
+
+    int choosePlay(const GameState& state, const PlayList& plays) override;
+
+    void ponder(const GameState& state) override
+    {
+        if (!ponderer)
+            ponderer.reset(new Ponderer(evaluator, table, maxDepth, seconds));
+        ponderer->start(state);
+    }
+
+    void stopPondering() override
+    {
+        if (ponderer)
+            ponderer->stop();
+    }
+
+    bool offerDouble(const GameState& state, const MatchState& match) override;
+    bool acceptDouble(const GameState& state, const MatchState& match) override;
+};
+
+// Settings for training the neural network by playing it against itself
+struct TrainOptions
+{
+    long games = 10000;
+    int threads = 1;
+
+    // Learning rate and how quickly the credit for a result fades going back through the game
+    float alpha = 0.1f;
+    float lambda = 0.7f;
+
+    // Games between saving the weights and showing progress
+    long checkpointGames = 1000;
+    std::string path = "weights.bin";
+    uint64_t seed = 1;
+};
+
+// Temporal difference learning, TD(lambda), for one thread playing games with the network. Every weight has an
+// eligibility trace per output, and each time a new position is seen the weights move by the change in the
+// network's outputs times those traces. Outputs are compared as seen by WHITE, since the network itself always
+// sees the position from the side of the player to move.
+// The network is shared by every training thread and updated without locks (Hogwild style): updates from
+// different threads rarely touch the same weights at once, and losing one now and then does not hurt training
+struct TDLearner
+{
+    NeuralNetwork& network;
+    float alpha;
+    float lambda;
+
+    // traces[k] lines up with the network weights in the order hidden weights, hidden bias, output weights, output bias
+    std::vector<float> traces[NeuralNetwork::OUTPUTS];
+    std::vector<float> inputs;
+    std::vector<float> hidden;
+    float outputs[NeuralNetwork::OUTPUTS * NeuralNetwork::BATCH_LANES];
+    float previous[NeuralNetwork::OUTPUTS];
+    bool hasPrevious = false;
+
+    TDLearner(NeuralNetwork& network, float alpha, float lambda)
+        : network(network), alpha(alpha), lambda(lambda),
+          inputs((size_t)NeuralNetwork::INPUTS * NeuralNetwork::BATCH_LANES, 0.0f),
+          hidden((size_t)network.hidden * NeuralNetwork::BATCH_LANES, 0.0f)
+    {
+        size_t weights = network.hiddenWeights.size() + network.hiddenBias.size() + network.outputWeights.size() + network.outputBias.size();
+        for (std::vector<float>& trace : traces)
+            trace.assign(weights, 0.0f);
+    }
+
+    void startGame()
+    {
+        for (std::vector<float>& trace : traces)
+            std::fill(trace.begin(), trace.end(), 0.0f);
+        hasPrevious = false;
+    }
+
+    // Learns from the step to a new position, "side" is seen from the player to move
+    void observe(const SideBoard& side, bool whiteToMove)
+    {
+        const int stride = NeuralNetwork::BATCH_LANES;
+        NeuralNetwork::encode(side.own, side.opp, inputs.data(), stride);
+        network.forward(inputs.data(), stride, 1, hidden.data(), outputs);
+
+        // Turn the outputs around to WHITE's side: BLACK's win is WHITE's loss and their gammons swap over 
+        static const int SOURCE[2][NeuralNetwork::OUTPUTS] = { { 0, 1, 2, 3, 4 }, { 0, 3, 4, 1, 2 } };
+        int mover = whiteToMove ? 0 : 1;
+        float current[NeuralNetwork::OUTPUTS];
+        for (int k = 0; k < NeuralNetwork::OUTPUTS; k++)
+            current[k] = outputs[SOURCE[mover][k] * stride];
+        if (!whiteToMove)
+            current[0] = 1 - current[0];
+
+        if (hasPrevious)
+            update(current);
+
+        // Fade the traces and add the gradient of each output at this position 
+        int units = network.hidden;
+        for (int k = 0; k < NeuralNetwork::OUTPUTS; k++)
+        {
+            int source = SOURCE[mover][k];
+            float sign = (k == 0 && !whiteToMove) ? -1.0f : 1.0f;
+            float y = outputs[source * stride];
+            float delta = sign * y * (1 - y);
+            float* trace = traces[k].data();
+            float* hiddenWeightTrace = trace;
+            float* hiddenBiasTrace = hiddenWeightTrace + network.hiddenWeights.size();
+            float* outputWeightTrace = hiddenBiasTrace + units;
+            float* outputBiasTrace = outputWeightTrace + (size_t)NeuralNetwork::OUTPUTS * units;
+
+            for (int h = 0; h < units; h++)
+            {
+                float activation = hidden[(size_t)h * stride];
+                float hiddenDelta = delta * network.outputWeights[(size_t)source * units + h] * activation * (1 - activation);
+                float* row = hiddenWeightTrace + (size_t)h * NeuralNetwork::INPUTS;
+                for (int i = 0; i < NeuralNetwork::INPUTS; i++)
+                    row[i] = lambda * row[i] + hiddenDelta * inputs[(size_t)i * stride];
+                hiddenBiasTrace[h] = lambda * hiddenBiasTrace[h] + hiddenDelta;
+            }
+            for (int o = 0; o < NeuralNetwork::OUTPUTS; o++)
+            {
+                float outputDelta = o == source ? delta : 0.0f;
+                for (int h = 0; h < units; h++)
+                    outputWeightTrace[(size_t)o * units + h] = lambda * outputWeightTrace[(size_t)o * units + h] + outputDelta * hidden[(size_t)h * stride];
+                outputBiasTrace[o] = lambda * outputBiasTrace[o] + outputDelta;
+            }
+        }
+
+        std::memcpy(previous, current, sizeof(previous));
+        hasPrevious = true;
+    }
+
+    // Learns from the final result of the game, given as WHITE's win, gammon and backgammon wins and losses
+    void finish(const float result[])
+    {
+        if (hasPrevious)
+            update(result);
+        hasPrevious = false;
+    }
+
+    // Moves every weight by alpha times the change in each output times that output's trace
+    void update(const float target[])
+    {
+        float error[NeuralNetwork::OUTPUTS];
+        for (int k = 0; k < NeuralNetwork::OUTPUTS; k++)
+            error[k] = alpha * (target[k] - previous[k]);
+        std::vector<float>* weights[4] = { &network.hiddenWeights, &network.hiddenBias, &network.outputWeights, &network.outputBias };
+        size_t offset = 0;
+        for (std::vector<float>* layer : weights)
+        {
+            float* w = layer->data();
+            size_t count = layer->size();
+            for (int k = 0; k < NeuralNetwork::OUTPUTS; k++)
+            {
+                const float* trace = traces[k].data() + offset;
+                for (size_t i = 0; i < count; i++)
+                    w[i] += error[k] * trace[i];
+            }
+            offset += count;
+        }
+    }
+};
+
+// Settings for rolling out a position
+struct RolloutOptions
+{
+    long trials = 1296;
+    int threads = 1;
+
+    // Plies played with quasi-random dice: trial n rolls (n mod 36) first, then ((n / 36) mod 36) and so on, each ply
+    // through its own shuffle of the 36 rolls, so every first roll comes up equally often
+    int quasiRandomPlies = 2;
+
+    // Plies whose luck (the best play's value for the roll minus its average over all rolls) is taken off the result
+    int luckPlies = 4;
+
+    // Stop once the standard error of the equity is at or below this (0 always plays every trial), checked after minTrials
+    double targetError = 0;
+    long minTrials = 324;
+
+    uint64_t seed = 1;
+};
+
+// Estimated outcome of a position for the player to roll, the chances are out of 1 and the equity is in points
+struct RolloutResult
+{
+    double win = 0;
+    double winGammon = 0;
+    double winBackgammon = 0;
+    double loseGammon = 0;
+    double loseBackgammon = 0;
+
+    // Equity with the luck adjustment, its standard error and the plain average of the results
+    double equity = 0;
+    double standardError = 0;
+    double rawEquity = 0;
+
+    long trials = 0;
+    double seconds = 0;
+};
+
+// Results of a batch of games played without a human
+struct SelfPlayStats
+{
+    long games = 0;
+    long whiteWins = 0;
+    long blackWins = 0;
+    long gammons = 0;
+    long backgammons = 0;
+    long plies = 0;
+
+    void add(const SelfPlayStats& other)
+    {
+        games += other.games;
+        whiteWins += other.whiteWins;
+        blackWins += other.blackWins;
+        gammons += other.gammons;
+        backgammons += other.backgammons;
+        plies += other.plies;
+    }
+};
+
+// Binary log of games. The file starts with "BGGR" and a 32 bit version, followed by one record per game:
+//   uint32    size of the rest of the record in bytes
+//   uint8     flags: bit 0 BLACK moved first, bit 1 BLACK won, bits 2-3 the points won (0 if the game did not finish)
+//   10 bytes  position key of the first position, seen by the player who moved first
+//   uint16    number of plies
+//   uint32    number of the game in its selfplay batch
+//   uint64    seed of the batch, so "runner replay <game> ... <seed>" plays the game again
+// then for every ply a byte holding numMoves * 36 + (first die - 1) * 6 + (second die - 1), followed by a byte for each
+// move with its starting point counted from the mover's home (25 is the bar) in the low 5 bits and the die in the rest.
+// Numbers are little endian as on the machines the games are played on
+const char GAME_RECORD_MAGIC[4] = { 'B', 'G', 'G', 'R' };
+const uint32_t GAME_RECORD_VERSION = 2;
+
+// Bytes in a record before its first ply
+const uint32_t GAME_RECORD_HEADER = 25;
+
+// One game being recorded, kept by the thread playing it and handed to GameRecordWriter once the game is over.
+// The bytes are the record without its size and are reused from game to game
+struct GameRecord
+{
+    std::vector<uint8_t> bytes;
+    uint16_t plies = 0;
+
+    // Game number and seed of the batch the game is played in, set before the game starts
+    uint32_t game = 0;
+    uint64_t seed = 0;
+
+    // Starts a new record from the position the game starts in
+    void start(const GameState& state)
+    {
+        PositionKey key = state.positionKey();
+        bytes.clear();
+        bytes.push_back(state.currentPlayer == Player::BLACK ? 1 : 0);
+        bytes.insert(bytes.end(), key.data, key.data + 10);
+        bytes.push_back(0);
+        bytes.push_back(0);
+        for (int i = 0; i < 4; i++)
+            bytes.push_back((uint8_t)(game >> (8 * i)));
+        for (int i = 0; i < 8; i++)
+            bytes.push_back((uint8_t)(seed >> (8 * i)));
+        plies = 0;
+    }
+
+    // Adds a ply, the dice in the order they were rolled and the play the player made with them
+    void addPly(Player player, int dieOne, int dieTwo, const Play& play)
+    {
+        bytes.push_back((uint8_t)(play.numMoves * 36 + (dieOne - 1) * 6 + (dieTwo - 1)));
+        for (int i = 0; i < play.numMoves; i++)
+        {
+            int from = play.moves[i].from;
+            int point = from == -1 ? 25 : (player == Player::WHITE ? from + 1 : BOARD_SIZE - from);
+            bytes.push_back((uint8_t)(point | (play.dice[i] << 5)));
+        }
+        plies++;
+        bytes[11] = (uint8_t)(plies & 0xFF);
+        bytes[12] = (uint8_t)(plies >> 8);
+    }
+
+    // Stores the result once the game is over
+    void finish(Player winner, int points)
+    {
+        if (winner == Player::BLACK)
+            bytes[0] |= 2;
+        bytes[0] |= (uint8_t)(points << 2);
+    }
+};
+
+// Appends finished game records to a log file. Records are gathered in a large buffer and written in big blocks,
+// write() can be called from any number of threads
+class GameRecordWriter
+{
+public:
+    static const size_t BUFFER_SIZE = 1 << 20;
+
+    GameRecordWriter() {}
+    GameRecordWriter(const GameRecordWriter&) = delete;
+    GameRecordWriter& operator=(const GameRecordWriter&) = delete;
+
+    ~GameRecordWriter()
+    {
+        close();
+    }
+
+    // Creates the log file and writes its header, returns false if it cannot be created
+    bool open(const std::string& path)
+    {
+        close();
+        file = std::fopen(path.c_str(), "wb");
+        if (!file)
+            return false;
+        buffer.reserve(BUFFER_SIZE + 4096);
+        buffer.insert(buffer.end(), GAME_RECORD_MAGIC, GAME_RECORD_MAGIC + 4);
+        append(GAME_RECORD_VERSION);
+        failed = false;
+        return true;
+    }
+
+    void write(const GameRecord& record)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!file)
+            return;
+        append((uint32_t)record.bytes.size());
+        buffer.insert(buffer.end(), record.bytes.begin(), record.bytes.end());
+        games++;
+        if (buffer.size() >= BUFFER_SIZE)
+            flush();
+    }
+
+    // Writes what is left in the buffer and closes the file, returns false if anything could not be written
+    bool close()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!file)
+            return !failed;
+        flush();
+        if (std::fclose(file) != 0)
+            failed = true;
+        file = nullptr;
+        return !failed;
+    }
+
+    long gamesWritten() const
+    {
+        return games;
+    }
+
+private:
+    void append(uint32_t value)
+    {
+        uint8_t bytes[4] = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+        buffer.insert(buffer.end(), bytes, bytes + 4);
+    }
+
+    void flush()
+    {
+        if (!buffer.empty() && std::fwrite(buffer.data(), 1, buffer.size(), file) != buffer.size())
+            failed = true;
+        buffer.clear();
+    }
+
+    std::mutex lock;
+    FILE* file = nullptr;
+    std::vector<uint8_t> buffer;
+    long games = 0;
+    bool failed = false;
+};
+
+// A game inside a mapped log, pointing straight into the file
+struct GameRecordView
+{
+    const uint8_t* data = nullptr;
+    uint32_t size = 0;
+
+    bool blackFirst() const
+    {
+        return data[0] & 1;
+    }
+
+    // Points won by the winner, 0 if the game did not finish
+    int points() const
+    {
+        return (data[0] >> 2) & 3;
+    }
+
+    Player winner() const
+    {
+        return data[0] & 2 ? Player::BLACK : Player::WHITE;
+    }
+
+    int plies() const
+    {
+        return data[11] | (data[12] << 8);
+    }
+
+    // Number of the game in its selfplay batch and the seed of the batch
+    long game() const
+    {
+        uint32_t number;
+        std::memcpy(&number, data + 13, 4);
+        return number;
+    }
+
+    uint64_t seed() const
+    {
+        uint64_t value;
+        std::memcpy(&value, data + 17, 8);
+        return value;
+    }
+};
+
+// Reads the games of a log in order from the memory-mapped file, nothing is copied
+class GameRecordReader
+{
+public:
+    // Maps the log, returns false if it is missing or not a game log
+    bool open(const std::string& path)
+    {
+        if (!file.open(path))
+            return false;
+        uint32_t version;
+        if (file.size() < 8 || std::memcmp(file.data(), GAME_RECORD_MAGIC, 4) != 0)
+        {
+            file.close();
+            return false;
+        }
+        std::memcpy(&version, file.data() + 4, 4);
+        if (version != GAME_RECORD_VERSION)
+        {
+            file.close();
+            return false;
+        }
+        offset = 8;
+        return true;
+    }
+
+    // Moves on to the next game, returns false at the end of the log or at a record that is cut short
+    bool next(GameRecordView& game)
+    {
+        if (offset + 4 > file.size())
+            return false;
+        uint32_t size;
+        std::memcpy(&size, file.data() + offset, 4);
+        if (size < GAME_RECORD_HEADER || offset + 4 + size > file.size())
+            return false;
+        game.data = file.data() + offset + 4;
+        game.size = size;
+        offset += 4 + size;
+        return true;
+    }
+
+    // Goes back to the first game
+    void rewind()
+    {
+        offset = 8;
+    }
+
+private:
+    MappedFile file;
+    size_t offset = 0;
+};
+
+// Steps through the positions of a recorded game. After start, every call to next() makes the previous play and
+// decodes the next one: state is then the position the play was made from with its dice in state.dice
+struct GameRecordReplay
+{
+    GameState state;
+    Play play;
+    int dieOne = 0, dieTwo = 0;
+
+    // Sets up the first position of a game, returns false if the record is damaged
+    bool start(const GameRecordView& game)
+    {
+        record = game;
+        state.currentPlayer = game.blackFirst() ? Player::BLACK : Player::WHITE;
+        PositionKey key;
+        std::memcpy(key.data, game.data + 1, 10);
+        if (!state.setPositionKey(key))
+            return false;
+        state.dice.clear();
+        play.numMoves = 0;
+        ply = 0;
+        offset = GAME_RECORD_HEADER;
+        return true;
+    }
+
+    // Returns false once there are no more plies (the last play has then been made) or the record is damaged
+    bool next()
+    {
+        if (ply > 0)
+        {
+            state.applyPlay(play);
+            state.switchPlayer();
+        }
+        if (ply == record.plies() || offset >= record.size)
+            return false;
+
+        int code = record.data[offset++];
+        int numMoves = code / 36;
+        if (numMoves > 4 || offset + numMoves > record.size)
+            return false;
+        dieOne = code / 6 % 6 + 1;
+        dieTwo = code % 6 + 1;
+        state.dice.setDice(dieOne, dieTwo);
+
+        // Turn the points counted from the mover's home back into board indexes 
+        bool white = state.currentPlayer == Player::WHITE;
+        play.numMoves = numMoves;
+        for (int i = 0; i < numMoves; i++)
+        {
+            int point = record.data[offset] & 31;
+            int die = record.data[offset++] >> 5;
+            if (point < 1 || point > 25 || die < 1 || die > 6)
+                return false;
+            int to = point - die;
+            play.dice[i] = die;
+            play.moves[i].from = point == 25 ? -1 : (white ? point - 1 : BOARD_SIZE - point);
+            play.moves[i].to = to <= 0 ? 24 : (white ? to - 1 : BOARD_SIZE - to);
+        }
+        ply++;
+        return true;
+    }
+
+private:
+    GameRecordView record;
+    int ply = 0;
+    uint32_t offset = 0;
+};
+
+#ifdef HAVE_EPOLL
+// A game hosted by the server, each side is played by a connected client or by a bot
+struct ServerGame
+{
+    int id = 0;
+    GameState state;
+    RandomDice dice;
+
+    // Connection playing each side (WHITE, BLACK), -1 if nobody has taken it
+    int seats[2] = { -1, -1 };
+
+    // Policy of the bot playing each side, empty for a side played by a client
+    std::string bots[2];
+
+    // Changes with every move, so that a bot's answer for a position that has since changed is dropped
+    uint64_t serial = 0;
+};
+
+// A client of the server with the bytes read but not handled yet and the bytes still to send
+struct ServerConnection
+{
+    int fd = -1;
+    std::string input;
+    std::string output;
+    int game = -1;
+    Player side = Player::WHITE;
+    bool writing = false;
+    bool closing = false;
+};
+
+// Position a bot has to play, handed to a worker and back to the event loop with the play it chose
+struct BotJob
+{
+    int game;
+    uint64_t serial;
+    GameState state;
+    std::string policy;
+    Play play;
+};
+
+// Server hosting many games at once for clients on a local TCP port. One thread runs an epoll event loop that reads
+// commands, checks moves with the rules and sends the results, bot sides choose their plays on a pool of workers.
+// Every command and answer is one line:
+//   NEW <white|black> <human|random|greedy|neural|search>  start a game against a bot, or wait for someone to JOIN
+//   JOIN <game>                                           take the free side of a game
+//   MOVE <from> <to>                                      move a piece with the point numbers of the console game
+//   STATE                                                 send the state of the game again
+//   QUIT                                                  leave the game
+//   METRICS                                               engine metrics in the Prometheus text format, sent as
+//                                                         METRICS <lines> and then that many lines (-DENABLE_METRICS)
+// The server sends JOINED <game> <side>, STATE <game> <side to move> <position id> <dice left>...,
+// VOID <game> <side> <dice> when a roll cannot be played, MOVED <game> <side> <from> <to> [HIT],
+// LEFT <game> <side>, OVER <game> <winner> <points> and ERR <message>
+class GameServer
+{
+public:
+    GameServer(int workers, uint64_t seed);
+    ~GameServer();
+
+    // Listens on 127.0.0.1 and serves clients until the process is stopped, returns false if it cannot listen
+    bool run(int port);
+
+private:
+    void acceptClients();
+    void readClient(ServerConnection& connection);
+    void handleCommand(ServerConnection& connection, const std::string& line);
+    void send(ServerConnection& connection, const std::string& text);
+    void flush(ServerConnection& connection);
+    void markClosing(ServerConnection& connection);
+    void closeClient(int fd);
+    void newGame(ServerConnection& connection, const std::string& side, const std::string& opponent);
+    void joinGame(ServerConnection& connection, int id);
+    void leaveGame(ServerConnection& connection);
+    void moveChecker(ServerConnection& connection, int from, int to);
+    void makeMove(ServerGame& game, const Move& move, int die);
+    void endMove(ServerGame& game);
+    void startTurn(ServerGame& game);
+    void finishBotTurns();
+    void broadcast(ServerGame& game, const std::string& text);
+    std::string stateText(const ServerGame& game) const;
+    void workerLoop(int index);
+
+    int listenFd = -1;
+    int epollFd = -1;
+    int wakeFd = -1;
+    uint64_t seed;
+    int nextGame = 1;
+    long moves = 0;
+    std::unordered_map<int, std::unique_ptr<ServerConnection>> connections;
+    std::unordered_map<int, std::unique_ptr<ServerGame>> games;
+
+    // Connections with output to send and connections to close once the current events have been handled
+    std::vector<int> dirty;
+    std::vector<int> pendingClose;
+
+    // Bot positions waiting for a worker and the plays the workers have chosen
+    std::vector<std::thread> workers;
+    std::mutex jobLock;
+    std::condition_variable jobReady;
+    std::deque<BotJob> jobs;
+    std::deque<BotJob> done;
+    bool stopping = false;
+};
+
+// Settings for the load generator, which plays many games against a server's bots at once
+struct LoadOptions
+{
+    int port = 4500;
+    int clients = 500;
+    int threads = 4;
+    double seconds = 10;
+    std::string opponent = "random";
+    uint64_t seed = 1;
+};
+
+// One connection of the load generator with the times of the moves it is waiting on an answer for
+struct LoadClient
+{
+    int fd = -1;
+    std::string input;
+    Player side = Player::WHITE;
+    std::deque<std::chrono::steady_clock::time_point> sent;
+};
+#endif
+
+// Settings for a batch of games played without a human
+struct SelfPlayOptions
+{
+    long games = 1000;
+    int threads = 1;
+    std::string whitePolicy = "random";
+    std::string blackPolicy = "random";
+    uint64_t seed = 1;
+
+    // Every game is written to this game log if it is set
+    std::string recordPath;
+};
+
+// Settings for a batch of matches played with the cube, money games when the length is 0
+struct MatchOptions
+{
+    int length = 7;
+    long matches = 100;
+    int threads = 1;
+    std::string whitePolicy = "neural";
+    std::string blackPolicy = "neural";
+    uint64_t seed = 1;
+};
+
+// Results of a batch of matches, points are counted with the cube
+struct MatchStats
+{
+    long matches = 0;
+    long whiteWins = 0;
+    long blackWins = 0;
+    long games = 0;
+    long plies = 0;
+    long whitePoints = 0;
+    long blackPoints = 0;
+    long doubles = 0;
+    long passes = 0;
+    long gammons = 0;
+
+    void add(const MatchStats& other)
+    {
+        matches += other.matches;
+        whiteWins += other.whiteWins;
+        blackWins += other.blackWins;
+        games += other.games;
+        plies += other.plies;
+        whitePoints += other.whitePoints;
+        blackPoints += other.blackPoints;
+        doubles += other.doubles;
+        passes += other.passes;
+        gammons += other.gammons;
+    }
+};
+
+// Range of game numbers a self-play worker still has to play, idle workers steal the upper half of another worker's range
+struct GameRange
+{
+    std::mutex lock;
+    long next = 0;
+    long end = 0;
+};
+
+// A position of the benchmark corpus, the position ID is seen by WHITE on roll
+struct BenchPosition
+{
+    const char* category;
+    const char* positionID;
+};
+
+// Fixed corpus for the benchmarks, taken from seeded self-play games so every build is measured on the same positions
+const BenchPosition BENCH_CORPUS[] = {
+    { "opening", "4HPwATDgc/ABMA" },
+    { "opening", "4PPCATDgc/ABMA" },
+    { "opening", "sGfwATDg88IBMA" },
+    { "opening", "wueGATCwZ/ABMA" },
+    { "opening", "4OfgATDgc/ABMA" },
+    { "opening", "4FfwASjg5+ABMA" },
+    { "opening", "0M/gQSDgJ/gAVA" },
+    { "contact", "xm03ACDemMEAMQ" },
+    { "contact", "xu02AAHbjIMAIw" },
+    { "contact", "uxkPAAbG7W4AAA" },
+    { "contact", "+2YMAAYbt20AAA" },
+    { "contact", "kh/wGALCH/AAMg" },
+    { "contact", "w8ZkAjSUTyQUEw" },
+    { "contact", "JwcJgh4xBxsiBw" },
+    { "race", "vwEAAL7PRBAAAA" },
+    { "race", "fwAAAN/PIAEAAA" },
+    { "race", "u+0NAADe3AwwAA" },
+    { "race", "u7cNAAC+uQMwAA" },
+    { "race", "/wAAAL7bKEAAAA" },
+    { "race", "/94AAgDvGzMAAA" },
+    { "race", "WwMAAP+lBCEAAA" },
+    { "bearoff", "954DAID91gMAAA" },
+    { "bearoff", "BwAA8B0AAAAAAA" },
+    { "bearoff", "/20FAAB/AAAAAA" },
+    { "bearoff", "HwAAwH9bAQAAAA" },
+    { "bearoff", "v+cARAC+BwAAAA" },
+    { "bearoff", "AgAA/N4OAAAAAA" },
+    { "bearoff", "3zMoCQC/+wAAAA" },
+    { "bar", "JydREBpYBwPJcA" },
+    { "bar", "TK/gAQaJMRxgdA" },
+    { "bar", "mZ7gIQSJMRxgcg" },
+    { "bar", "s7UDIAnBc+EAcA" },
+    { "bar", "wXPhAHCztQMgCQ" },
+    { "bar", "11YjQAjBc+EAcA" },
+    { "bar", "wXPhAGRnqxEgRA" },
+};
+
+// Settings for the benchmarks
+struct BenchOptions
+{
+    // Each benchmark repeats passes over its positions for at least this long
+    double seconds = 0.5;
+    long games = 1000;
+    uint64_t seed = 1;
+};
+
+// Timing of one benchmark, the checksum is for a single pass so that it is the same on every run and build
+struct BenchResult
+{
+    std::string name;
+    std::string category;
+    long calls = 0;
+    double seconds = 0;
+    uint64_t checksum = 0;
+};
+
+// Games and seed of the default "runner selftest" and the digest of its results, recorded from the rules as they were
+// before they were written as templates on the side to move
+const long SELFTEST_GAMES = 100;
+const uint64_t SELFTEST_SEED = 1;
+const uint64_t SELFTEST_DIGEST = 0xB7408C14E4987466ULL;
+
+// Settings for analysing a stream of positions
+struct AnalysisOptions
+{
+    // Plies searched for every play, 1 is the evaluation of the position after it
+    int depth = 1;
+    int threads = 1;
+
+    // Positions read but not written yet, 0 is 64 per thread. Reading waits once this many are in flight
+    int window = 0;
+
+    // The input is read from standard input if no path is set
+    std::string inputPath;
+};
+
+//function prototypes
+void initGame(GameState& state);
+void printBoard(const GameState& state);
+void playGame(GameState& state, DiceSource& dice, PlayerPolicy* whiteBot, PlayerPolicy* blackBot);
+void playBotTurn(GameState& state, PlayerPolicy& bot);
+std::string adjustTurn(GameState& state);
+std::string moveMessage(MoveError error, const Move& move);
+std::string playText(const Play& play);
+bool isGameOver(const GameState& state);
+Player getWinner(const GameState& state);
+int getWinPoints(const GameState& state);
+std::unique_ptr<PlayerPolicy> makePolicy(const std::string& name);
+int playHeadlessGame(GameState& state, PlayerPolicy& white, PlayerPolicy& black, DiceSource& dice, GameRecord* record = nullptr,
+    const std::function<void(const GameState&, const Play&)>& onPly = nullptr);
+int playMatchGame(GameState& state, PlayerPolicy& white, PlayerPolicy& black, DiceSource& dice, MatchState& match, MatchStats& stats);
+MatchStats runMatches(const MatchOptions& options);
+CubeDecision decideCube(Evaluator& evaluator, const GameState& state, const MatchState& match);
+void startSeededGame(GameState& state, RandomDice& dice, PlayerPolicy& white, PlayerPolicy& black, uint64_t seed, long game);
+SelfPlayStats runSelfPlay(const SelfPlayOptions& options);
+int replayGame(const SelfPlayOptions& options, long game);
+bool exportGameRecords(const std::string& path, long first, long count, std::ostream& out);
+bool scanGameRecords(const std::string& path);
+std::string notationText(const GameState& state, const Play& play);
+const char* sideName(Player player);
+RolloutResult rollout(const GameState& state, Evaluator& evaluator, const RolloutOptions& options);
+void trainNetwork(NeuralNetwork& network, const TrainOptions& options);
+std::vector<BenchResult> runBenchmarks(const BenchOptions& options);
+GameState mirrorPosition(const GameState& state);
+long checkReplays(long games, uint64_t seed);
+bool runSelfTest(long games, uint64_t seed);
+#ifdef HAVE_EPOLL
+void runLoadGenerator(const LoadOptions& options);
+#endif
+long analyzePositions(const AnalysisOptions& options, std::ostream& out);
+std::string analyzePosition(const std::string& line, SearchEngine& engine, TranspositionTable& table, int depth);
+bool readLine(FILE* file, std::string& line);
+#ifdef ENABLE_METRICS
+void writeMetricsJSON(std::ostream& out, const MetricsSnapshot& metrics);
+void writeMetricsPrometheus(std::ostream& out, const MetricsSnapshot& metrics);
+void writeMetricsAtExit();
+#endif
+
+// Main function, "runner selfplay [games] [threads] [white policy] [black policy] [seed]" plays games without a human
+int main(int argc, char* argv[])
+{
+#ifdef ENABLE_METRICS
+    // Instrumented builds write their metrics when the program ends if RUNNER_METRICS names a file
+    if (std::getenv("RUNNER_METRICS"))
+        std::atexit(writeMetricsAtExit);
+#endif
+
+    // "runner bearoff [file]" builds the bearoff database, which is used from then on if it is in the working directory
+    if (argc > 1 && std::string(argv[1]) == "bearoff")
+    {
+        std::string path = argc > 2 ? argv[2] : "bearoff.db";
+        if (!BearoffDatabase::generate(path))
+        {
+            std::cout << "Could not write " << path << std::endl;
+            return 1;
+        }
+        std::cout << "Bearoff database written to " << path << std::endl;
+        return 0;
+    }
+    bearoffDatabase.open("bearoff.db");
+    openingBook.open("book.bin");
+    matchEquityTable.open("met.bin");
+
+    // The bots use the neural network once weights.bin has been trained
+    if (!neuralNetwork.load("weights.bin"))
+        neuralNetwork.initialize(80, 1);
+
+    // "runner train [games] [threads] [alpha] [lambda]" trains the network in weights.bin (or a new one) by self-play
+    if (argc > 1 && std::string(argv[1]) == "train")
+    {
+        TrainOptions options;
+        options.threads = (int)std::thread::hardware_concurrency();
+        if (argc > 2)
+            options.games = std::atol(argv[2]);
+        if (argc > 3)
+            options.threads = std::atoi(argv[3]);
+        if (argc > 4)
+            options.alpha = (float)std::atof(argv[4]);
+        if (argc > 5)
+            options.lambda = (float)std::atof(argv[5]);
+        if (options.threads < 1)
+            options.threads = 1;
+        trainNetwork(neuralNetwork, options);
+        return 0;
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "selfplay")
+    {
+        SelfPlayOptions options;
+        options.threads = (int)std::thread::hardware_concurrency();
+        if (argc > 2)
+            options.games = std::atol(argv[2]);
+        if (argc > 3)
+            options.threads = std::atoi(argv[3]);
+        if (argc > 4)
+            options.whitePolicy = argv[4];
+        if (argc > 5)
+            options.blackPolicy = argv[5];
+        if (argc > 6)
+            options.seed = std::strtoull(argv[6], nullptr, 10);
+        if (argc > 7)
+            options.recordPath = argv[7];
+        if (options.threads < 1)
+            options.threads = 1;
+        if (!makePolicy(options.whitePolicy) || !makePolicy(options.blackPolicy))
+        {
+            std::cout << "Unknown policy, use random, greedy, neural or search" << std::endl;
+            return 1;
+        }
+        runSelfPlay(options);
+        return 0;
+    }
+
+    // "runner match [length] [matches] [threads] [white policy] [black policy] [seed]" plays matches with the cube, a
+    // length of 0 plays money games
+    if (argc > 1 && std::string(argv[1]) == "match")
+    {
+        MatchOptions options;
+        options.threads = (int)std::thread::hardware_concurrency();
+        if (argc > 2)
+            options.length = std::atoi(argv[2]);
+        if (argc > 3)
+            options.matches = std::atol(argv[3]);
+        if (argc > 4)
+            options.threads = std::atoi(argv[4]);
+        if (argc > 5)
+            options.whitePolicy = argv[5];
+        if (argc > 6)
+            options.blackPolicy = argv[6];
+        if (argc > 7)
+            options.seed = std::strtoull(argv[7], nullptr, 10);
+        if (options.threads < 1)
+            options.threads = 1;
+        if (options.length < 0 || options.length > MatchEquityTable::MAX_AWAY)
+        {
+            std::cout << "The match length must be from 0 (money games) to " << MatchEquityTable::MAX_AWAY << std::endl;
+            return 1;
+        }
+        if (!makePolicy(options.whitePolicy) || !makePolicy(options.blackPolicy))
+        {
+            std::cout << "Unknown policy, use random, greedy, neural or search" << std::endl;
+            return 1;
+        }
+        runMatches(options);
+        return 0;
+    }
+
+    // "runner replay <game> [white policy] [black policy] [seed]" plays one game of a selfplay batch again, ply by ply
+    if (argc > 2 && std::string(argv[1]) == "replay")
+    {
+        SelfPlayOptions options;
+        if (argc > 3)
+            options.whitePolicy = argv[3];
+        if (argc > 4)
+            options.blackPolicy = argv[4];
+        if (argc > 5)
+            options.seed = std::strtoull(argv[5], nullptr, 10);
+        if (!makePolicy(options.whitePolicy) || !makePolicy(options.blackPolicy))
+        {
+            std::cout << "Unknown policy, use random, greedy, neural or search" << std::endl;
+            return 1;
+        }
+        replayGame(options, std::atol(argv[2]));
+        return 0;
+    }
+
+    // "runner export <game log> [first game] [games]" prints recorded games in the usual match notation
+    if (argc > 2 && std::string(argv[1]) == "export")
+    {
+        long first = argc > 3 ? std::atol(argv[3]) : 0;
+        long count = argc > 4 ? std::atol(argv[4]) : -1;
+        if (!exportGameRecords(argv[2], first, count, std::cout))
+        {
+            std::cout << "Could not read " << argv[2] << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // "runner scan <game log>" goes through every position of a game log and shows how fast it can be read
+    if (argc > 2 && std::string(argv[1]) == "scan")
+    {
+        if (!scanGameRecords(argv[2]))
+        {
+            std::cout << "Could not read " << argv[2] << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // "runner serve [port] [workers] [seed]" hosts games for clients on a local TCP port
+    if (argc > 1 && std::string(argv[1]) == "serve")
+    {
+#ifdef HAVE_EPOLL
+        int port = argc > 2 ? std::atoi(argv[2]) : 4500;
+        int workers = argc > 3 ? std::atoi(argv[3]) : 2;
+        uint64_t seed = argc > 4 ? std::strtoull(argv[4], nullptr, 10) : (uint64_t)time(NULL);
+        GameServer server(workers > 0 ? workers : 1, seed);
+        if (!server.run(port))
+        {
+            std::cout << "Could not listen on port " << port << std::endl;
+            return 1;
+        }
+        return 0;
+#else
+        std::cout << "The server needs Linux (epoll)" << std::endl;
+        return 1;
+#endif
+    }
+
+    // "runner loadgen [port] [clients] [seconds] [opponent] [threads]" plays many games against a server at once
+    if (argc > 1 && std::string(argv[1]) == "loadgen")
+    {
+#ifdef HAVE_EPOLL
+        LoadOptions options;
+        if (argc > 2)
+            options.port = std::atoi(argv[2]);
+        if (argc > 3)
+            options.clients = std::atoi(argv[3]);
+        if (argc > 4)
+            options.seconds = std::atof(argv[4]);
+        if (argc > 5)
+            options.opponent = argv[5];
+        if (argc > 6)
+            options.threads = std::atoi(argv[6]);
+        if (options.threads < 1)
+            options.threads = 1;
+        runLoadGenerator(options);
+        return 0;
+#else
+        std::cout << "The load generator needs Linux (epoll)" << std::endl;
+        return 1;
+#endif
+    }
+
+    // "runner bench [seconds] [games] [seed]" times the rules engine on a fixed corpus of positions and prints JSON
+    if (argc > 1 && std::string(argv[1]) == "bench")
+    {
+        BenchOptions options;
+        if (argc > 2)
+            options.seconds = std::atof(argv[2]);
+        if (argc > 3)
+            options.games = std::atol(argv[3]);
+        if (argc > 4)
+            options.seed = std::strtoull(argv[4], nullptr, 10);
+        runBenchmarks(options);
+        return 0;
+    }
+
+    // "runner selftest [games] [seed]" checks the rules on seeded random games, the exit status is 1 if a check fails
+    if (argc > 1 && std::string(argv[1]) == "selftest")
+    {
+        long games = argc > 2 ? std::atol(argv[2]) : SELFTEST_GAMES;
+        uint64_t seed = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : SELFTEST_SEED;
+        return runSelfTest(games, seed) ? 0 : 1;
+    }
+
+    // "runner book [plies] [trials] [file]" builds the opening book (book.bin by default), rolling out the best few
+    // plays for every roll over the first plies
+    if (argc > 1 && std::string(argv[1]) == "book")
+    {
+        int plies = argc > 2 ? std::atoi(argv[2]) : 2;
+        long trials = argc > 3 ? std::atol(argv[3]) : 324;
+        std::string path = argc > 4 ? argv[4] : "book.bin";
+        int threads = std::max((int)std::thread::hardware_concurrency(), 1);
+        if (plies < 1 || trials < 1)
+        {
+            std::cout << "Usage: runner book [plies] [trials] [file]" << std::endl;
+            return 1;
+        }
+        if (!OpeningBook::generate(path, plies, trials, threads))
+        {
+            std::cout << "Could not write " << path << std::endl;
+            return 1;
+        }
+        std::cout << "Opening book written to " << path << std::endl;
+        return 0;
+    }
+
+    // "runner rollout <position id> [trials] [threads] [white|black]" rolls out a position for the player to roll
+    if (argc > 2 && std::string(argv[1]) == "rollout")
+    {
+        GameState state;
+        initGame(state);
+        if (argc > 5 && std::string(argv[5]) == "black")
+            state.switchPlayer();
+        if (!state.setPositionID(argv[2]))
+        {
+            std::cout << "Invalid position ID" << std::endl;
+            return 1;
+        }
+        RolloutOptions options;
+        options.threads = (int)std::thread::hardware_concurrency();
+        if (argc > 3)
+            options.trials = std::atol(argv[3]);
+        if (argc > 4)
+            options.threads = std::atoi(argv[4]);
+        if (options.threads < 1)
+            options.threads = 1;
+        HeuristicEvaluator heuristic;
+        NeuralEvaluator neural(neuralNetwork);
+        RaceEvaluator race(neuralNetwork.loaded ? (Evaluator&)neural : heuristic);
+        BearoffEvaluator evaluator(bearoffDatabase, race);
+        RolloutResult result = rollout(state, evaluator, options);
+        std::cout << "Trials: " << result.trials << " in " << result.seconds << " s (" << result.trials / result.seconds << " trials/sec)" << std::endl;
+        std::cout << "Win: " << result.win << "  Win gammon: " << result.winGammon << "  Win backgammon: " << result.winBackgammon << std::endl;
+        std::cout << "Lose gammon: " << result.loseGammon << "  Lose backgammon: " << result.loseBackgammon << std::endl;
+        std::cout << "Equity: " << result.equity << " +/- " << result.standardError << " (without luck adjustment: " << result.rawEquity << ")" << std::endl;
+        return 0;
+    }
+
+    // "runner analyze [depth] [threads] [file]" ranks every play for each "<position id> <die> <die>" line of a file or
+    // standard input and writes one line per position in the same order
+    if (argc > 1 && std::string(argv[1]) == "analyze")
+    {
+        AnalysisOptions options;
+        options.threads = (int)std::thread::hardware_concurrency();
+        if (argc > 2)
+            options.depth = std::atoi(argv[2]);
+        if (argc > 3)
+            options.threads = std::atoi(argv[3]);
+        if (argc > 4)
+            options.inputPath = argv[4];
+        if (options.threads < 1)
+            options.threads = 1;
+        if (options.depth < 1)
+        {
+            std::cout << "Usage: runner analyze [depth] [threads] [file]" << std::endl;
+            return 1;
+        }
+        auto start = std::chrono::steady_clock::now();
+        long positions = analyzePositions(options, std::cout);
+        if (positions < 0)
+        {
+            std::cout << "Could not read " << options.inputPath << std::endl;
+            return 1;
+        }
+        // The summary goes to standard error so that standard output only has the results
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cerr << "Positions: " << positions << " at depth " << options.depth << " on " << options.threads << " threads in " << seconds
+            << " s (" << positions / seconds << " positions/sec)" << std::endl;
+        return 0;
+    }
+
+    // "runner search <position id> <dice one> <dice two> [seconds] [white|black]" shows the search for one roll
+    if (argc > 4 && std::string(argv[1]) == "search")
+    {
+        GameState state;
+        initGame(state);
+        if (argc > 6 && std::string(argv[6]) == "black")
+            state.switchPlayer();
+        if (!state.setPositionID(argv[2]))
+        {
+            std::cout << "Invalid position ID" << std::endl;
+            return 1;
+        }
+        int dieOne = std::atoi(argv[3]);
+        int dieTwo = std::atoi(argv[4]);
+        if (dieOne < 1 || dieOne > 6 || dieTwo < 1 || dieTwo > 6)
+        {
+            std::cout << "Dice must be between 1 and 6" << std::endl;
+            return 1;
+        }
+        state.dice.setDice(dieOne, dieTwo);
+        static PlayList plays;
+        state.generatePlays(plays);
+        SearchPolicy bot(8, argc > 5 ? std::atof(argv[5]) : 1.0, true);
+        bot.choosePlay(state, plays);
+        return 0;
+    }
+
+    // Seed the dice from the clock
+    RandomDice dice((uint64_t)time(NULL));
+
+    // Create the game state
+    GameState state;
+    initGame(state);
+
+    // "runner bot [white|black] [seconds]" plays against a search bot, which takes black unless told otherwise
+    std::unique_ptr<PlayerPolicy> bot;
+    bool botIsWhite = false;
+    if (argc > 1 && std::string(argv[1]) == "bot")
+    {
+        botIsWhite = argc > 2 && std::string(argv[2]) == "white";
+        bot.reset(new SearchPolicy(8, argc > 3 ? std::atof(argv[3]) : 2.0));
+    }
+
+    // Play the game
+    playGame(state, dice, botIsWhite ? bot.get() : nullptr, botIsWhite ? nullptr : bot.get());
+
+    return 0;
+}
+
+// Initializes the game state
+void initGame(GameState& state)
+{
+    // Clear the board
+    for (int i = 0; i < BOARD_SIZE; i++)
+        state.board[i] = 0;
+
+    // Place the pieces on the board
+    state.board[0] = 2;
+    state.board[11] = 5;
+    state.board[16] = 3;
+    state.board[18] = 5;
+
+    state.board[23] = -2;
+    state.board[12] = -5;
+    state.board[7] = -3;
+    state.board[5] = -5;
+
+    // Set the initial number of pieces on the bar and in the home quadrant
+    state.whiteBar = 0;
+    state.blackBar = 0;
+    state.whiteGoal = 0;
+    state.blackGoal = 0;
+
+    // Set the current player to white
+    state.currentPlayer = Player::WHITE;
+
+    // Hash the starting position
+    state.rehash();
+}
+
+// Prints the current board state
+void printBoard(const GameState& state)
+{
+    std::cout << "=====================================================" << std::endl;
+
+    // Show current dice (moves) 
+    for (int i = 0; i < state.dice.count; i++)
+        std::cout << "Dice " + std::to_string(i + 1) + ": " << state.dice.diceNums[i] << std::endl;
+
+    std::string tempBoardTop = "";
+    std::string tempBoardBottom = "";
+    int count = 0;
+
+    for (int index = 12; index < BOARD_SIZE; index++)
+    {
+        if (count == 6)
+        {
+            tempBoardTop.append("| | ");
+            tempBoardBottom.append("| | ");
+        }
+        tempBoardTop.append("(" + std::to_string(state.board[index]) + ") ");
+        tempBoardBottom.append("(" + std::to_string(state.board[23 - index]) + ") ");
+        count++;
+    }
+
+    std::cout << "\n" << tempBoardTop << "\n\n" << std::endl;
+    std::cout << tempBoardBottom << "\n\n" << std::endl;
+    std::cout << "White Bar: " << state.whiteBar << std::endl;
+    std::cout << "Black Bar: " << state.blackBar << "\n\n";
+
+    if (state.whiteGoal || state.blackGoal)
+    {
+        std::cout << "White Goal: " << state.whiteGoal << std::endl;
+        std::cout << "Black Goal: " << state.blackGoal << "\n\n";
+    }
+    std::cout << "=====================================================" << std::endl;
+}
+
+// Plays a game of backgammon, players without a bot enter their moves at the console
+void playGame(GameState& state, DiceSource& dice, PlayerPolicy* whiteBot, PlayerPolicy* blackBot)
+{
+    // Display general information
+    std::cout << "Welcome to the wonderful game of backgammon!\n1. from = 0 to move from bar\n2. to = 25 to bear off\n3. from = -2 to swap dice\n\n";
+    // While the game is not over keep switching players 
+    while (!isGameOver(state))
+    {
+        // Roll the dice 
+        state.dice.rollDice(dice);
+
+        // Check to make sure the player has possible moves, the message for the player is shown after their turn
+        std::string message = adjustTurn(state);
+
+        // If the current player is a bot let it make its whole play 
+        PlayerPolicy* bot = state.currentPlayer == Player::WHITE ? whiteBot : blackBot;
+        if (bot && !state.dice.empty())
+        {
+            printBoard(state);
+            playBotTurn(state, *bot);
+        }
+
+        // A bot playing against the human thinks about its replies while the human enters the moves
+        PlayerPolicy* opponent = state.currentPlayer == Player::WHITE ? blackBot : whiteBot;
+        if (opponent && !state.dice.empty())
+            opponent->ponder(state);
+
+        // While there is still a move available and the game is not over 
+        while (!state.dice.empty() && !isGameOver(state))
+        {
+            // Print the board
+            printBoard(state);
+
+            // Variables to hold players turn 
+            int from, to;
+
+            // Get player's move, loop if the user's inputs are out of range, check if the player is swapping the dice or asking for general info 
+            do
+            {
+                std::cout << "~ from = -3 to view game information again" << std::endl;
+                std::cout << "Player " << (state.currentPlayer == Player::WHITE ? "White" : "Black") << ", enter your move (from point *enter*, to point *enter*): " << std::endl;
+                std::cin >> from >> to;
+                if (from == -2)
+                {
+                    state.dice.swap();
+                    std::cout << " Dice swapped please enter a move" << std::endl;
+                }
+                else if (from == -3)
+                    std::cout<< "1. from = 0 to move from bar\n2.to = 25 to bear off\n3.from = -2 to swap dice\nPlease enter a move\n\n";
+                from--;
+                to--;
+            } while (from < -1 || from > 23 || to < 0 || to > 25);
+
+            // Check the move against the first dice 
+            Move move = { from, to };
+            MoveError error = state.validateMove(move, state.dice.diceNums[0]);
+            message = moveMessage(error, move);
+
+            // If the move is valid make it, remove dice (move) from diceNums and check to make sure the player still has a valid move 
+            if (error == MoveError::NONE)
+            {
+                if (state.applyMove(move).hit)
+                    std::cout << state.currentPlayer << " hit at point: " << move.to + 1 << std::endl;
+                state.dice.useFirst();
+                if (!state.dice.empty())
+                    message += adjustTurn(state);
+
+                // Once part of the play is made only the replies to the plays that are still possible are pondered
+                if (opponent && !state.dice.empty() && !isGameOver(state))
+                    opponent->ponder(state);
+            }
+
+            // Display result of turn, clear message 
+            std::cout << "\n" << state.currentPlayer << message << "\n\n";
+            message.clear();
+        }
+        // Display result of turn if adjustTurn found there is no available moves for player 
+        if (!message.empty())
+            std::cout << state.currentPlayer << message << "\n\n";
+        if (opponent)
+            opponent->stopPondering();
+
+        // Switch players
+        state.switchPlayer();
+    }
+
+    // Print the board one last time
+    printBoard(state);
+
+    // Announce the winner
+    std::cout << "Player " << (getWinner(state) == Player::WHITE ? "White" : "Black") << " wins!" << std::endl;
+}
+
+// Lets a bot choose a play and makes its moves one at a time through validateMove, the same way a human's moves are made
+void playBotTurn(GameState& state, PlayerPolicy& bot)
+{
+    static thread_local PlayList plays;
+    state.generatePlays(plays);
+    const Play& play = plays.plays[plays.count > 1 ? bot.choosePlay(state, plays) : 0];
+    std::cout << state.currentPlayer << " plays " << playText(play) << "\n\n";
+
+    for (int i = 0; i < play.numMoves; i++)
+    {
+        // Put the dice used for this move first 
+        if (state.dice.diceNums[0] != play.dice[i])
+            state.dice.swap();
+        const Move& move = play.moves[i];
+        MoveError error = state.validateMove(move, state.dice.diceNums[0]);
+        if (error != MoveError::NONE)
+            break;
+        if (state.applyMove(move).hit)
+            std::cout << state.currentPlayer << " hit at point: " << move.to + 1 << std::endl;
+        state.dice.useFirst();
+        std::cout << state.currentPlayer << moveMessage(error, move) << "\n";
+    }
+    state.dice.clear();
+    std::cout << std::endl;
+}
+
+// Adjusts the dice for the moves the current player has, returns the message voiding the turn if there are none
+std::string adjustTurn(GameState& state)
+{
+    diceRoll rolled = state.dice;
+    if (state.adjustDice())
+        return "";
+    std::string message = "\n~ has no valid moves, voiding turn, diceOne: " + std::to_string(rolled.diceNums[0]);
+    if (rolled.count > 1)
+        message += " diceTwo: " + std::to_string(rolled.diceNums[1]);
+    return message;
+}
+
+// Returns the message for the player after a move was checked, using the point numbers the players enter
+std::string moveMessage(MoveError error, const Move& move)
+{
+    std::string from = std::to_string(move.from + 1);
+    std::string to = std::to_string(move.to + 1);
+    switch (error)
+    {
+    case MoveError::MUST_MOVE_FROM_BAR:
+        return " has at least one barred piece";
+    case MoveError::NOTHING_ON_BAR:
+        return " does not have any barred pieces";
+    case MoveError::CANNOT_BEAR_OFF:
+        return " cannot bear off";
+    case MoveError::BAR_BLOCKED:
+        return " cannot move from bar to point: " + to;
+    case MoveError::BEAR_OFF_TOO_FAR:
+        return " cannot bear off from here, the piece is too far from home or you have no pieces at point: " + from;
+    case MoveError::BEAR_OFF_HIGHER_PIECES:
+        return " cannot bear off from point: " + from + ", there are pieces in higher positions in your home";
+    case MoveError::BLOCKED:
+        return " cannot move from point: " + from + " to point: " + to;
+    default:
+        break;
+    }
+
+    // If the player moved from bar 
+    if (move.from == -1)
+        return " moved from bar to point: " + to;
+    // If the player beared off 
+    if (move.to == 24)
+        return " beared off from point: " + from;
+    // Otherwise it was a normal move 
+    return " moved from point: " + from + " to point: " + to;
+}
+
+// Returns a play as text using the same point numbers the players enter (0 is the bar and 25 is bearing off)
+std::string playText(const Play& play)
+{
+    if (play.numMoves == 0)
+        return "no move";
+    std::string text;
+    for (int i = 0; i < play.numMoves; i++)
+    {
+        if (i > 0)
+            text += " ";
+        text += std::to_string(play.moves[i].from + 1) + "/" + std::to_string(play.moves[i].to + 1);
+    }
+    return text;
+}
+
+// Returns true if the game is over, false otherwise
+bool isGameOver(const GameState& state)
+{
+    return state.whiteGoal == NUM_PIECES || state.blackGoal == NUM_PIECES;
+}
+
+// Returns the winner of the game
+Player getWinner(const GameState& state)
+{
+    return state.whiteGoal == NUM_PIECES ? Player::WHITE : Player::BLACK;
+}
+
+// Returns the points won by the winner: 1 for a single game, 2 for a gammon (the loser has not borne off any pieces)
+// and 3 for a backgammon (the loser also still has a piece on the bar or in the winner's home quadrant)
+int getWinPoints(const GameState& state)
+{
+    bool whiteWon = getWinner(state) == Player::WHITE;
+    if ((whiteWon ? state.blackGoal : state.whiteGoal) > 0)
+        return 1;
+
+    // The winner's home quadrant is the loser's points 19-24, beyond that is the bar
+    return state.farthest[whiteWon ? 1 : 0] >= 19 ? 3 : 2;
+}
+
+// Returns a new policy by name ("random", "greedy", "neural" for one ply with the neural network or the race evaluator in races, or "search" for
+// a two ply search), or nullptr for an unknown name
+std::unique_ptr<PlayerPolicy> makePolicy(const std::string& name)
+{
+    if (name == "random")
+        return std::unique_ptr<PlayerPolicy>(new RandomPolicy());
+    if (name == "greedy")
+        return std::unique_ptr<PlayerPolicy>(new GreedyPolicy());
+    if (name == "neural")
+    {
+        static NeuralEvaluator neural(neuralNetwork);
+        static RaceEvaluator race(neural);
+        return std::unique_ptr<PlayerPolicy>(new EvaluatorPolicy(race));
+    }
+    if (name == "search")
+        return std::unique_ptr<PlayerPolicy>(new SearchPolicy(2, 0.0, false, 16));
+    return nullptr;
+}
+
+// Plays a game from the given state to the end with the policies choosing every play, returns the number of plies played
+// The game is also added to "record" if there is one, and onPly (if set) is shown every ply before the play is made,
+// with the dice in the state
+int playHeadlessGame(GameState& state, PlayerPolicy& white, PlayerPolicy& black, DiceSource& dice, GameRecord* record,
+    const std::function<void(const GameState&, const Play&)>& onPly)
+{
+    // The list of plays is kept per thread because it is too large for the stack
+    static thread_local PlayList plays;
+    int plies = 0;
+    if (record)
+        record->start(state);
+
+    while (!isGameOver(state))
+    {
+        // Roll the dice and let the current player's policy choose one of the legal plays 
+        state.dice.clear();
+        state.dice.rollDice(dice);
+        state.generatePlays(plays);
+        PlayerPolicy& policy = state.currentPlayer == Player::WHITE ? white : black;
+        int choice = plays.count > 1 ? policy.choosePlay(state, plays) : 0;
+        if (record)
+            record->addPly(state.currentPlayer, state.dice.diceNums[0], state.dice.diceNums[1], plays.plays[choice]);
+        if (onPly)
+            onPly(state, plays.plays[choice]);
+        state.applyPlay(plays.plays[choice]);
+        plies++;
+
+        // Switch players
+        state.switchPlayer();
+    }
+    state.dice.clear();
+    if (record)
+        record->finish(getWinner(state), getWinPoints(state));
+    return plies;
+}
+
+// Sets up game number "game" of a batch played from "seed": the board, the dice and both policies get the same seeds
+// whichever thread plays the game, so any game of a batch can be played again on its own
+void startSeededGame(GameState& state, RandomDice& dice, PlayerPolicy& white, PlayerPolicy& black, uint64_t seed, long game)
+{
+    uint64_t gameSeed = Xoshiro256::streamSeed(seed, (uint64_t)game);
+    dice.rng.seed(gameSeed);
+    white.reset(gameSeed ^ 0x5851F42D4C957F2DULL);
+    black.reset(gameSeed ^ 0x14057B7EF767814FULL);
+    initGame(state);
+}
+
+// Plays game number "game" of a selfplay batch again with the same dice and choices, printing every ply, returns the plies
+int replayGame(const SelfPlayOptions& options, long game)
+{
+    std::unique_ptr<PlayerPolicy> white = makePolicy(options.whitePolicy);
+    std::unique_ptr<PlayerPolicy> black = makePolicy(options.blackPolicy);
+    GameState state;
+    RandomDice dice;
+    startSeededGame(state, dice, *white, *black, options.seed, game);
+
+    // The moves are shown from the mover's side as in "runner export"
+    int ply = 0;
+    int plies = playHeadlessGame(state, *white, *black, dice, nullptr, [&ply](const GameState& position, const Play& play)
+        {
+            std::cout << ++ply << ". " << position.currentPlayer << " " << position.positionID() << " rolls " << position.dice.diceNums[0]
+                << position.dice.diceNums[1] << ": " << (play.numMoves > 0 ? notationText(position, play) : std::string("no move")) << std::endl;
+        });
+    std::cout << "Player " << (getWinner(state) == Player::WHITE ? "White" : "Black") << " wins " << getWinPoints(state) << " point(s) after " << plies << " plies" << std::endl;
+    return plies;
+}
+
+// Prints games of a game log in the match notation used by other backgammon programs: one line per pair of plies
+// with the dice and the moves from each player's own side, 25 for the bar, 0 for bearing off and * for a hit. Each game
+// is headed by its number in the selfplay batch and the seed, as "runner replay" takes them. Games are written to the
+// log as they finish, so "first" and "count" go by the order in the log
+bool exportGameRecords(const std::string& path, long first, long count, std::ostream& out)
+{
+    GameRecordReader reader;
+    if (!reader.open(path))
+        return false;
+    GameRecordView game;
+    GameRecordReplay replay;
+    const size_t COLUMN = 32;
+    for (long number = 0; (count < 0 || number < first + count) && reader.next(game); number++)
+    {
+        if (number < first || !replay.start(game))
+            continue;
+        out << " Game " << game.game() << " (seed " << game.seed() << ")\n     White" << std::string(COLUMN - 10, ' ') << "Black\n";
+
+        // WHITE's plies go in the left column and BLACK's in the right one, a game BLACK starts leaves the first one empty
+        int turn = 0;
+        std::string line;
+        while (replay.next())
+        {
+            std::string text = std::to_string(replay.dieOne) + std::to_string(replay.dieTwo) + ": " + notationText(replay.state, replay.play);
+            if (replay.state.currentPlayer == Player::WHITE || line.empty())
+            {
+                std::string number = std::to_string(++turn) + ")";
+                line = std::string(number.size() < 4 ? 4 - number.size() : 0, ' ') + number + " ";
+            }
+            if (replay.state.currentPlayer == Player::WHITE)
+                line += text;
+            else
+            {
+                out << line << std::string(line.size() < COLUMN ? COLUMN - line.size() : 1, ' ') << text << "\n";
+                line.clear();
+            }
+        }
+        if (!line.empty())
+            out << line << "\n";
+        if (game.points() > 0)
+            out << "  " << (game.winner() == Player::WHITE ? "White" : "Black") << " wins " << game.points() << " point" << (game.points() > 1 ? "s" : "") << "\n";
+        out << "\n";
+    }
+    return true;
+}
+
+// Returns the moves of a play as seen by the player making it, the state is the position before the play
+std::string notationText(const GameState& state, const Play& play)
+{
+    GameState after = state;
+    bool white = state.currentPlayer == Player::WHITE;
+    std::string text;
+    for (int i = 0; i < play.numMoves; i++)
+    {
+        const Move& move = play.moves[i];
+        int from = move.from == -1 ? 25 : (white ? move.from + 1 : BOARD_SIZE - move.from);
+        int to = move.to == 24 ? 0 : (white ? move.to + 1 : BOARD_SIZE - move.to);
+        if (i > 0)
+            text += " ";
+        text += std::to_string(from) + "/" + std::to_string(to);
+        if (after.applyMove(move).hit)
+            text += "*";
+    }
+    return text;
+}
+
+// Reads every position of every game in a game log and shows the totals and how fast they were read
+bool scanGameRecords(const std::string& path)
+{
+    auto start = std::chrono::steady_clock::now();
+    GameRecordReader reader;
+    if (!reader.open(path))
+        return false;
+    GameRecordView game;
+    GameRecordReplay replay;
+    long games = 0, positions = 0, damaged = 0, whiteWins = 0;
+    uint64_t check = 0;
+    while (reader.next(game))
+    {
+        games++;
+        if (!replay.start(game))
+        {
+            damaged++;
+            continue;
+        }
+        while (replay.next())
+        {
+            positions++;
+            check ^= replay.state.hash;
+        }
+        if (replay.state.whiteGoal != NUM_PIECES && replay.state.blackGoal != NUM_PIECES && game.points() > 0)
+            damaged++;
+        if (game.points() > 0 && game.winner() == Player::WHITE)
+            whiteWins++;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Display results
+    std::cout << "Games: " << games << "  Positions: " << positions << "  White wins: " << whiteWins << "  Damaged: " << damaged << std::endl;
+    std::cout << "Read in " << seconds << " s, positions/sec: " << (seconds > 0 ? positions / seconds : 0.0) << "  Check: " << std::hex << check << std::dec << std::endl;
+    return true;
+}
+
+// Returns the next game number for worker "id" to play, or -1 once every game has been handed out
+long takeGame(GameRange ranges[], int numRanges, int id)
+{
+    // Take the next game of this worker's own range 
+    {
+        std::lock_guard<std::mutex> guard(ranges[id].lock);
+        if (ranges[id].next < ranges[id].end)
+            return ranges[id].next++;
+    }
+
+    // Otherwise steal the upper half of the first other range that still has games 
+    for (int offset = 1; offset < numRanges; offset++)
+    {
+        GameRange& victim = ranges[(id + offset) % numRanges];
+        long begin, end;
+        {
+            std::lock_guard<std::mutex> guard(victim.lock);
+            long remaining = victim.end - victim.next;
+            if (remaining <= 0)
+                continue;
+            // If only one game is left it is taken whole
+            begin = victim.end - (remaining + 1) / 2;
+            end = victim.end;
+            victim.end = begin;
+        }
+        std::lock_guard<std::mutex> guard(ranges[id].lock);
+        ranges[id].next = begin + 1;
+        ranges[id].end = end;
+        return begin;
+    }
+    return -1;
+}
+
+// Plays a batch of games on all the requested threads and prints games/sec and win statistics
+SelfPlayStats runSelfPlay(const SelfPlayOptions& options)
+{
+    // Split the games evenly between the workers, workers that finish early steal from the others
+    std::unique_ptr<GameRange[]> ranges(new GameRange[options.threads]);
+    for (int i = 0; i < options.threads; i++)
+    {
+        ranges[i].next = options.games * i / options.threads;
+        ranges[i].end = options.games * (i + 1) / options.threads;
+    }
+
+    std::vector<SelfPlayStats> results(options.threads);
+    auto start = std::chrono::steady_clock::now();
+
+    // Every thread records its games on its own and hands them to the writer once they are over
+    GameRecordWriter writer;
+    if (!options.recordPath.empty() && !writer.open(options.recordPath))
+        std::cout << "Could not create " << options.recordPath << ", games are not recorded" << std::endl;
+    bool recording = !options.recordPath.empty();
+
+    std::vector<std::thread> workers;
+    for (int id = 0; id < options.threads; id++)
+        workers.emplace_back([&, id]()
+        {
+            std::unique_ptr<PlayerPolicy> white = makePolicy(options.whitePolicy);
+            std::unique_ptr<PlayerPolicy> black = makePolicy(options.blackPolicy);
+            SelfPlayStats& stats = results[id];
+            GameState state;
+            RandomDice dice;
+            GameRecord record;
+
+            // Every game gets its own seed from its game number so a game plays the same on any thread 
+            for (long game = takeGame(ranges.get(), options.threads, id); game != -1; game = takeGame(ranges.get(), options.threads, id))
+            {
+                startSeededGame(state, dice, *white, *black, options.seed, game);
+                record.game = (uint32_t)game;
+                record.seed = options.seed;
+                stats.plies += playHeadlessGame(state, *white, *black, dice, recording ? &record : nullptr);
+                if (recording)
+                    writer.write(record);
+                stats.games++;
+                getWinner(state) == Player::WHITE ? stats.whiteWins++ : stats.blackWins++;
+                int points = getWinPoints(state);
+                if (points == 2)
+                    stats.gammons++;
+                else if (points == 3)
+                    stats.backgammons++;
+            }
+        });
+    for (std::thread& worker : workers)
+        worker.join();
+    bool written = recording && writer.close();
+
+    SelfPlayStats total;
+    for (const SelfPlayStats& stats : results)
+        total.add(stats);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Display results
+    double games = total.games > 0 ? (double)total.games : 1.0;
+    std::cout << "Games: " << total.games << " on " << options.threads << " threads in " << seconds << " s" << std::endl;
+    std::cout << "Games/sec: " << total.games / seconds << "  Plies/sec: " << total.plies / seconds << std::endl;
+    std::cout << "White (" << options.whitePolicy << ") wins: " << total.whiteWins << " (" << 100.0 * total.whiteWins / games << "%)" << std::endl;
+    std::cout << "Black (" << options.blackPolicy << ") wins: " << total.blackWins << " (" << 100.0 * total.blackWins / games << "%)" << std::endl;
+    std::cout << "Gammons: " << total.gammons << "  Backgammons: " << total.backgammons << "  Average plies: " << total.plies / games << std::endl;
+    if (written)
+        std::cout << "Games written to " << options.recordPath << std::endl;
+    else if (recording)
+        std::cout << "Could not write all games to " << options.recordPath << std::endl;
+    return total;
+}
+
+// Plays one game of a match with the cube. Before each roll the player on roll may double if the match allows it,
+// and a double that is passed ends the game. The game is scored in match, returns the number of plies played
+int playMatchGame(GameState& state, PlayerPolicy& white, PlayerPolicy& black, DiceSource& dice, MatchState& match, MatchStats& stats)
+{
+    static thread_local PlayList plays;
+    int plies = 0;
+    while (!isGameOver(state))
+    {
+        int player = state.currentPlayer == Player::WHITE ? 0 : 1;
+        PlayerPolicy& policy = player == 0 ? white : black;
+        PlayerPolicy& other = player == 0 ? black : white;
+        if (match.canDouble(player) && policy.offerDouble(state, match))
+        {
+            stats.doubles++;
+            if (!other.acceptDouble(state, match))
+            {
+                stats.passes++;
+                match.finishGame(player, 1);
+                return plies;
+            }
+            match.takeDouble(player);
+        }
+
+        state.dice.clear();
+        state.dice.rollDice(dice);
+        state.generatePlays(plays);
+        int choice = plays.count > 1 ? policy.choosePlay(state, plays) : 0;
+        state.applyPlay(plays.plays[choice]);
+        plies++;
+        state.switchPlayer();
+    }
+    state.dice.clear();
+    int points = getWinPoints(state);
+    if (points > 1)
+        stats.gammons++;
+    match.finishGame(getWinner(state) == Player::WHITE ? 0 : 1, points);
+    return plies;
+}
+
+// Plays a batch of matches on all the requested threads and prints matches/sec, the wins and the cube actions
+MatchStats runMatches(const MatchOptions& options)
+{
+    // Matches are shared out and stolen the same way as the games of a selfplay batch
+    std::unique_ptr<GameRange[]> ranges(new GameRange[options.threads]);
+    for (int i = 0; i < options.threads; i++)
+    {
+        ranges[i].next = options.matches * i / options.threads;
+        ranges[i].end = options.matches * (i + 1) / options.threads;
+    }
+
+    std::vector<MatchStats> results(options.threads);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int id = 0; id < options.threads; id++)
+        workers.emplace_back([&, id]()
+        {
+            std::unique_ptr<PlayerPolicy> white = makePolicy(options.whitePolicy);
+            std::unique_ptr<PlayerPolicy> black = makePolicy(options.blackPolicy);
+            MatchStats& stats = results[id];
+            GameState state;
+            RandomDice dice;
+
+            // Every match gets its own seed from its number, the dice run on from game to game within it
+            for (long number = takeGame(ranges.get(), options.threads, id); number != -1; number = takeGame(ranges.get(), options.threads, id))
+            {
+                startSeededGame(state, dice, *white, *black, options.seed, number);
+                MatchState match;
+                match.length = options.length;
+                for (long game = 0; game == 0 || !match.over(); game++)
+                {
+                    // The sides take turns to start
+                    initGame(state);
+                    if (game % 2 == 1)
+                        state.switchPlayer();
+                    int before[2] = { match.score[0], match.score[1] };
+                    stats.plies += playMatchGame(state, *white, *black, dice, match, stats);
+                    stats.games++;
+                    stats.whitePoints += match.score[0] - before[0];
+                    stats.blackPoints += match.score[1] - before[1];
+                    if (match.length == 0)
+                        break;
+                }
+                stats.matches++;
+                if (match.length > 0)
+                    match.score[0] >= match.length ? stats.whiteWins++ : stats.blackWins++;
+                else if (match.score[0] != match.score[1])
+                    match.score[0] > match.score[1] ? stats.whiteWins++ : stats.blackWins++;
+            }
+        });
+    for (std::thread& worker : workers)
+        worker.join();
+
+    MatchStats total;
+    for (const MatchStats& stats : results)
+        total.add(stats);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Display results, a money session has one game per "match"
+    double matches = total.matches > 0 ? (double)total.matches : 1.0;
+    double games = total.games > 0 ? (double)total.games : 1.0;
+    if (options.length > 0)
+        std::cout << "Matches: " << total.matches << " to " << options.length << " points on " << options.threads << " threads in " << seconds << " s" << std::endl;
+    else
+        std::cout << "Money games: " << total.matches << " on " << options.threads << " threads in " << seconds << " s" << std::endl;
+    std::cout << "Matches/sec: " << total.matches / seconds << "  Games/sec: " << total.games / seconds << "  Plies/sec: " << total.plies / seconds << std::endl;
+    std::cout << "White (" << options.whitePolicy << ") wins: " << total.whiteWins << " (" << 100.0 * total.whiteWins / matches << "%)  points: "
+        << total.whitePoints << " (" << total.whitePoints / games << " per game)" << std::endl;
+    std::cout << "Black (" << options.blackPolicy << ") wins: " << total.blackWins << " (" << 100.0 * total.blackWins / matches << "%)  points: "
+        << total.blackPoints << " (" << total.blackPoints / games << " per game)" << std::endl;
+    std::cout << "Games per match: " << total.games / matches << "  Doubles: " << total.doubles << "  Passed: " << total.passes
+        << "  Gammons: " << total.gammons << std::endl;
+    return total;
+}
+
+// Scores each play by making it on a copy of the state, evaluating the position for the opponent and taking it back
+void Evaluator::evaluatePlays(const GameState& state, const PlayList& plays, float values[])
+{
+    static thread_local GameState child;
+    child = state;
+    for (int i = 0; i < plays.count; i++)
+    {
+        MoveUndo undo[4];
+        child.applyPlay(plays.plays[i], undo);
+        if (isGameOver(child))
+            values[i] = (float)getWinPoints(child);
+        else
+        {
+            child.switchPlayer();
+            values[i] = -evaluate(child);
+            child.switchPlayer();
+        }
+        child.undoPlay(undo, plays.plays[i].numMoves);
+    }
+}
+
+// Spreads the equity over the results with the gammon shares the match equity table is made with. A side that has
+// borne off a piece cannot lose a gammon
+void Evaluator::evaluateChances(const GameState& state, float chances[5])
+{
+    bool white = state.currentPlayer == Player::WHITE;
+    bool ownOff = (white ? state.whiteGoal : state.blackGoal) > 0;
+    bool oppOff = (white ? state.blackGoal : state.whiteGoal) > 0;
+    float winGammon = oppOff ? 0 : MatchEquityTable::GAMMON_SHARE;
+    float winBackgammon = oppOff ? 0 : MatchEquityTable::BACKGAMMON_SHARE;
+    float loseGammon = ownOff ? 0 : MatchEquityTable::GAMMON_SHARE;
+    float loseBackgammon = ownOff ? 0 : MatchEquityTable::BACKGAMMON_SHARE;
+
+    // The equity is winning * (1 + winGammon + winBackgammon) - (1 - winning) * (1 + loseGammon + loseBackgammon)
+    float winPoints = 1 + winGammon + winBackgammon;
+    float losePoints = 1 + loseGammon + loseBackgammon;
+    float winning = std::min(std::max((evaluate(state) + losePoints) / (winPoints + losePoints), 0.0f), 1.0f);
+    chances[0] = winning;
+    chances[1] = winning * winGammon;
+    chances[2] = winning * winBackgammon;
+    chances[3] = (1 - winning) * loseGammon;
+    chances[4] = (1 - winning) * loseBackgammon;
+}
+
+// Spreads the chance of winning a race with the same gammon shares. Nothing can be hit any more, so a side that has
+// borne off a piece cannot lose a gammon and a side with no piece left in the other side's home quadrant cannot lose
+// a backgammon
+void Evaluator::raceChances(const GameState& state, float winning, float chances[5])
+{
+    int own = state.currentPlayer == Player::WHITE ? 0 : 1;
+    bool ownOff = (own == 0 ? state.whiteGoal : state.blackGoal) > 0;
+    bool oppOff = (own == 0 ? state.blackGoal : state.whiteGoal) > 0;
+    chances[0] = winning;
+    chances[1] = oppOff ? 0 : winning * MatchEquityTable::GAMMON_SHARE;
+    chances[2] = oppOff || state.farthest[1 - own] < 19 ? 0 : winning * MatchEquityTable::BACKGAMMON_SHARE;
+    chances[3] = ownOff ? 0 : (1 - winning) * MatchEquityTable::GAMMON_SHARE;
+    chances[4] = ownOff || state.farthest[own] < 19 ? 0 : (1 - winning) * MatchEquityTable::BACKGAMMON_SHARE;
+}
+
+// Works out the cube action for the player on roll from one cubeless evaluation of the position
+CubeDecision decideCube(Evaluator& evaluator, const GameState& state, const MatchState& match)
+{
+    float chances[5];
+    evaluator.evaluateChances(state, chances);
+    int player = state.currentPlayer == Player::WHITE ? 0 : 1;
+    CubeModel model(match, player, chances);
+    CubeDecision decision;
+    decision.noDouble = model.cubeful(chances[0], match.cube, match.cubeOwner, CubeModel::DEPTH);
+    decision.doubleTake = model.cubeful(chances[0], 2 * match.cube, 1 - player, CubeModel::DEPTH);
+    decision.doublePass = model.value(match.cube);
+    return decision;
+}
+
+bool EvaluatorPolicy::offerDouble(const GameState& state, const MatchState& match)
+{
+    return decideCube(evaluator, state, match).shouldDouble();
+}
+
+bool EvaluatorPolicy::acceptDouble(const GameState& state, const MatchState& match)
+{
+    return decideCube(evaluator, state, match).shouldTake();
+}
+
+bool SearchPolicy::offerDouble(const GameState& state, const MatchState& match)
+{
+    return decideCube(evaluator, state, match).shouldDouble();
+}
+
+bool SearchPolicy::acceptDouble(const GameState& state, const MatchState& match)
+{
+    return decideCube(evaluator, state, match).shouldTake();
+}
+
+SearchEngine::SearchEngine(Evaluator& evaluator, TranspositionTable& table)
+    : evaluator(evaluator), table(table), nodes(0), nextCheck(CHECK_NODES), stopped(false), timed(false), cancelled(false)
+{
+}
+
+// Searches the plays for the roll in state.dice one ply deeper at a time, keeping the best play of the last finished depth
+SearchResult SearchEngine::search(const GameState& state, const PlayList& plays, int maxDepth, double seconds, bool verbose)
+{
+    auto start = std::chrono::steady_clock::now();
+    timed = seconds > 0;
+    deadline = start + std::chrono::microseconds((long long)(seconds * 1e6));
+    stopped = false;
+    nodes = 0;
+    nextCheck = CHECK_NODES;
+    while ((int)plies.size() < maxDepth + 1)
+        plies.emplace_back(new Ply);
+
+    SearchResult result;
+    if (plays.count <= 1)
+        return result;
+
+    // Root plays are ordered by the values found at the previous depth, best first 
+    std::vector<int> order(plays.count);
+    std::vector<float> values(plays.count, LOWEST);
+    for (int i = 0; i < plays.count; i++)
+        order[i] = i;
+    GameState position = state;
+
+    for (int depth = 1; depth <= maxDepth && !stopped; depth++)
+    {
+        float alpha = LOWEST - 1;
+        int best = -1;
+        for (int i : order)
+        {
+            float value = childValue(position, plays.plays[i], depth, alpha, HIGHEST);
+            if (stopped)
+                break;
+            values[i] = value;
+            if (value > alpha)
+            {
+                alpha = value;
+                best = i;
+            }
+        }
+
+        // A depth cut short by the time budget is only used if nothing has been finished yet
+        if (best != -1 && (!stopped || result.depth == 0))
+        {
+            result.bestPlay = best;
+            result.value = alpha;
+            result.depth = stopped ? 0 : depth;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return values[a] > values[b]; });
+
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (verbose && !stopped)
+            std::cout << "depth " << depth << ": " << playText(plays.plays[result.bestPlay]) << " equity " << result.value
+                << "  nodes " << nodes << "  nodes/sec " << (elapsed > 0 ? nodes / elapsed : 0.0) << std::endl;
+    }
+
+    result.nodes = nodes;
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+// Scores every play for analysis, one ply deep with a single batched call and otherwise by searching each play in turn
+long SearchEngine::evaluatePlays(const GameState& state, const PlayList& plays, int depth, float values[])
+{
+    timed = false;
+    stopped = false;
+    nodes = 0;
+    nextCheck = CHECK_NODES;
+    if (depth <= 1)
+    {
+        evaluator.evaluatePlays(state, plays, values);
+        return plays.count;
+    }
+    while ((int)plies.size() < depth + 1)
+        plies.emplace_back(new Ply);
+    GameState position = state;
+    for (int i = 0; i < plays.count; i++)
+        values[i] = childValue(position, plays.plays[i], depth, LOWEST, HIGHEST);
+    return nodes;
+}
+
+int SearchPolicy::choosePlay(const GameState& state, const PlayList& plays)
+{
+    int book = openingBook.find(state, plays);
+    if (book >= 0)
+    {
+        if (verbose)
+            std::cout << "book: " << playText(plays.plays[book]) << std::endl;
+        return book;
+    }
+    if (!state.isRace())
+    {
+        int pondered = ponderer ? ponderer->find(state, plays) : -1;
+        if (ponderer)
+            ponderer->clear();
+        if (pondered >= 0)
+        {
+            if (verbose)
+                std::cout << "ponder: " << playText(plays.plays[pondered]) << std::endl;
+            return pondered;
+        }
+        return engine.search(state, plays, maxDepth, seconds, verbose).bestPlay;
+    }
+
+    int best = 0;
+    evaluator.evaluatePlays(state, plays, values);
+    for (int i = 1; i < plays.count; i++)
+        if (values[i] > values[best])
+            best = i;
+    if (verbose)
+        std::cout << "race: " << playText(plays.plays[best]) << " equity " << values[best] << std::endl;
+    return best;
+}
+
+void Ponderer::start(const GameState& state)
+{
+    stop();
+    thread = std::thread(&Ponderer::run, this, state);
+}
+
+void Ponderer::stop()
+{
+    engine.cancel();
+    if (thread.joinable())
+        thread.join();
+    engine.resume();
+}
+
+int Ponderer::find(const GameState& state, const PlayList& plays)
+{
+    // The roll is only known for sure while at least two dice are left (a double can only use some of its four)
+    if (state.dice.count < 2)
+        return -1;
+    int roll = OpeningBook::rollIndex(state.dice.diceNums[0], state.dice.diceNums[1]);
+    uint64_t target;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        auto found = replies.find(replyKey(state.hash, roll));
+        if (found == replies.end())
+            return -1;
+        target = found->second;
+    }
+
+    // The reply is matched on the position it leads to, since the plays may be listed in another order
+    GameState after = state;
+    for (int i = 0; i < plays.count; i++)
+    {
+        MoveUndo undo[4];
+        after.applyPlay(plays.plays[i], undo);
+        bool match = after.hash == target;
+        after.undoPlay(undo, plays.plays[i].numMoves);
+        if (match)
+            return i;
+    }
+    return -1;
+}
+
+// Goes through the other side's plays best first and searches the bot's reply to every roll after each of them,
+// until the plays run out or stop is called
+void Ponderer::run(GameState state)
+{
+    std::vector<float> values(MAX_PLAYS);
+    state.generatePlays(plays);
+    evaluator.evaluatePlays(state, plays, values.data());
+    std::vector<int> order(plays.count);
+    for (int i = 0; i < plays.count; i++)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return values[a] > values[b]; });
+
+    // Rolls that are twice as likely come first
+    int rolls[21];
+    for (int roll = 0; roll < 21; roll++)
+        rolls[roll] = roll;
+    std::stable_sort(rolls, rolls + 21, [](int a, int b) { return ROLLS.probability[a] > ROLLS.probability[b]; });
+
+    for (int i : order)
+    {
+        GameState reply = state;
+        reply.applyPlay(plays.plays[i]);
+        reply.dice.clear();
+
+        // Races and finished games are answered at once without a search
+        if (isGameOver(reply) || reply.isRace())
+            continue;
+        reply.switchPlayer();
+        for (int roll : rolls)
+        {
+            if (engine.isCancelled())
+                return;
+            uint64_t key = replyKey(reply.hash, roll);
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                if (replies.count(key))
+                    continue;
+            }
+            reply.dice.setDice(ROLLS.dice[roll][0], ROLLS.dice[roll][1]);
+            reply.generatePlays(answers);
+            if (answers.count <= 1 || openingBook.find(reply, answers) >= 0)
+                continue;
+            SearchResult result = engine.search(reply, answers, maxDepth, seconds);
+            if (engine.isCancelled())
+                return;
+            GameState after = reply;
+            after.applyPlay(answers.plays[result.bestPlay]);
+            std::lock_guard<std::mutex> guard(lock);
+            replies[key] = after.hash;
+        }
+    }
+}
+
+// Returns the equity of a play for the player making it, searching the position after it to "depth" - 1 plies
+// The play is made on state and taken back before returning
+float SearchEngine::childValue(GameState& state, const Play& play, int depth, float alpha, float beta)
+{
+    MoveUndo undo[4];
+    state.applyPlay(play, undo);
+    float value;
+    if (isGameOver(state))
+        value = (float)getWinPoints(state);
+    else
+    {
+        state.switchPlayer();
+        value = -chanceNode(state, depth - 1, -beta, -alpha);
+        state.switchPlayer();
+    }
+    state.undoPlay(undo, play.numMoves);
+    return value;
+}
+
+// Returns the equity for the player about to roll, the average over every roll of the best play for that roll
+float SearchEngine::chanceNode(GameState& state, int depth, float alpha, float beta)
+{
+    nodes++;
+    if (isGameOver(state))
+        return -(float)getWinPoints(state);
+    if (depth == 0)
+        return evaluator.evaluate(state);
+    // Plays scored while ordering are counted too, so the clock is checked once at least CHECK_NODES more have been visited
+    if (nodes >= nextCheck)
+    {
+        nextCheck = nodes + CHECK_NODES;
+        if (timeUp())
+            stopped = true;
+    }
+    if (stopped)
+        return 0;
+
+    // Use a stored result if it was searched at least as deep and settles the value for this window 
+    TableEntry entry;
+    if (table.probe(state.hash, entry) && entry.depth >= depth)
+    {
+        if (entry.bound == Bound::EXACT || (entry.bound == Bound::LOWER && entry.value >= beta) || (entry.bound == Bound::UPPER && entry.value <= alpha))
+            return entry.value;
+    }
+
+    // Star2: probe every roll with only its best ordered play, which gives a lower bound for that roll. If the
+    // bounds alone reach beta there is no need to search further
+    float lower[21];
+    float lowerSum = 0;
+    for (int roll = 0; roll < 21; roll++)
+    {
+        lower[roll] = depth >= 2 ? maxNode(state, roll, depth, LOWEST, HIGHEST, true) : LOWEST;
+        lowerSum += ROLLS.probability[roll] * lower[roll];
+    }
+    if (stopped)
+        return 0;
+    if (lowerSum >= beta)
+    {
+        table.store(state.hash, { lowerSum, depth, Bound::LOWER });
+        return lowerSum;
+    }
+
+    // Star1: search every roll with the window that could still change the result, assuming the rolls not searched
+    // yet are at their lower bound (to fail high) or the highest equity (to fail low)
+    float sum = 0;
+    float remaining = 1;
+    for (int roll = 0; roll < 21; roll++)
+    {
+        float probability = ROLLS.probability[roll];
+        lowerSum -= probability * lower[roll];
+        remaining -= probability;
+        float rollAlpha = (alpha - sum - HIGHEST * remaining) / probability;
+        float rollBeta = (beta - sum - lowerSum) / probability;
+        float value = maxNode(state, roll, depth, std::max(rollAlpha, LOWEST), std::min(rollBeta, HIGHEST), false);
+        if (stopped)
+            return 0;
+        if (value >= rollBeta)
+        {
+            float bound = sum + probability * value + lowerSum;
+            table.store(state.hash, { bound, depth, Bound::LOWER });
+            return bound;
+        }
+        if (value <= rollAlpha)
+        {
+            float bound = sum + probability * value + HIGHEST * remaining;
+            table.store(state.hash, { bound, depth, Bound::UPPER });
+            return bound;
+        }
+        sum += probability * value;
+    }
+    table.store(state.hash, { sum, depth, Bound::EXACT });
+    return sum;
+}
+
+// Returns the equity of the best play for a roll, only searching the best ordered play when probing
+float SearchEngine::maxNode(GameState& state, int roll, int depth, float alpha, float beta, bool probeOnly)
+{
+    nodes++;
+    Ply& ply = *plies[depth];
+    int rollDice[4];
+    int numDice = ROLLS.moves(roll, rollDice);
+    state.generatePlays(rollDice, numDice, ply.plays);
+
+    // Static values are exact for the last ply, otherwise they are only used to order the plays
+    int count = orderPlays(ply, state);
+    if (depth == 1)
+        return ply.score[ply.order[0]];
+
+    float best = LOWEST;
+    for (int i = 0; i < (probeOnly ? 1 : count); i++)
+    {
+        float value = childValue(state, ply.plays.plays[ply.order[i]], depth, std::max(alpha, best), beta);
+        if (stopped)
+            return 0;
+        if (value > best)
+        {
+            best = value;
+            if (best >= beta)
+                break;
+        }
+    }
+    return best;
+}
+
+// Scores every play in ply.plays by the static evaluation of the position after it and sorts ply.order best first
+int SearchEngine::orderPlays(Ply& ply, const GameState& state)
+{
+    int count = ply.plays.count;
+    evaluator.evaluatePlays(state, ply.plays, ply.score);
+    for (int i = 0; i < count; i++)
+        ply.order[i] = i;
+    nodes += count;
+    std::sort(ply.order, ply.order + count, [&](int a, int b) { return ply.score[a] > ply.score[b]; });
+    return count;
+}
+
+// Returns true once the time budget has run out or the search has been cancelled
+bool SearchEngine::timeUp()
+{
+    return cancelled.load(std::memory_order_relaxed) || (timed && std::chrono::steady_clock::now() >= deadline);
+}
+
+// Returns the value of the best play for a roll to the player making it, one ply deep, and the index of that play
+float bestPlayValue(const GameState& state, const int rollDice[], int numDice, Evaluator& evaluator, PlayList& plays, int& bestPlay)
+{
+    static thread_local float values[MAX_PLAYS];
+    state.generatePlays(rollDice, numDice, plays);
+    evaluator.evaluatePlays(state, plays, values);
+    bestPlay = (int)(std::max_element(values, values + plays.count) - values);
+    return values[bestPlay];
+}
+
+// Sums of the results of a block of rollout trials, as seen by the player to roll at the start
+struct RolloutTotals
+{
+    double win = 0;
+    double winGammon = 0;
+    double winBackgammon = 0;
+    double loseGammon = 0;
+    double loseBackgammon = 0;
+    double equity = 0;
+    double equitySquared = 0;
+    double rawEquity = 0;
+    long trials = 0;
+
+    void add(const RolloutTotals& other)
+    {
+        win += other.win;
+        winGammon += other.winGammon;
+        winBackgammon += other.winBackgammon;
+        loseGammon += other.loseGammon;
+        loseBackgammon += other.loseBackgammon;
+        equity += other.equity;
+        equitySquared += other.equitySquared;
+        rawEquity += other.rawEquity;
+        trials += other.trials;
+    }
+};
+
+// Plays one rollout trial to the end with one ply plays and adds its result to totals
+void rolloutTrial(const GameState& start, long trial, Evaluator& evaluator, const RolloutOptions& options, const int shuffles[][36], DiceSource& dice, RolloutTotals& totals)
+{
+    static thread_local PlayList plays;
+    static thread_local GameState state;
+    state = start;
+    state.dice.clear();
+    Player root = start.currentPlayer;
+    double luck = 0;
+    long stratum = trial;
+
+    for (int ply = 0; !isGameOver(state); ply++)
+    {
+        // The first plies take their roll from the trial number, the rest are random 
+        int rollDice[4];
+        if (ply < options.quasiRandomPlies)
+        {
+            int roll = shuffles[ply][stratum % 36];
+            stratum /= 36;
+            rollDice[0] = roll / 6 + 1;
+            rollDice[1] = roll % 6 + 1;
+        }
+        else
+        {
+            rollDice[0] = dice.nextDie();
+            rollDice[1] = dice.nextDie();
+        }
+        rollDice[2] = rollDice[3] = rollDice[0];
+        int numDice = rollDice[0] == rollDice[1] ? 4 : 2;
+
+        // Luck is how much better the roll was than the average roll, as seen by the player who rolled 
+        int bestPlay;
+        if (ply < options.luckPlies)
+        {
+            float average = 0;
+            for (int roll = 0; roll < 21; roll++)
+            {
+                int otherDice[4];
+                int otherCount = ROLLS.moves(roll, otherDice);
+                average += ROLLS.probability[roll] * bestPlayValue(state, otherDice, otherCount, evaluator, plays, bestPlay);
+            }
+            float rolled = bestPlayValue(state, rollDice, numDice, evaluator, plays, bestPlay);
+            luck += (state.currentPlayer == root ? 1 : -1) * (rolled - average);
+        }
+        else
+            bestPlayValue(state, rollDice, numDice, evaluator, plays, bestPlay);
+
+        state.applyPlay(plays.plays[bestPlay]);
+        if (!isGameOver(state))
+            state.switchPlayer();
+    }
+
+    int points = getWinPoints(state);
+    bool won = getWinner(state) == root;
+    double result = won ? points : -points;
+    totals.trials++;
+    totals.win += won;
+    totals.winGammon += won && points >= 2;
+    totals.winBackgammon += won && points == 3;
+    totals.loseGammon += !won && points >= 2;
+    totals.loseBackgammon += !won && points == 3;
+    totals.rawEquity += result;
+    totals.equity += result - luck;
+    totals.equitySquared += (result - luck) * (result - luck);
+}
+
+// Rolls out a position for the player to roll on several threads, stopping early once the result is precise enough.
+// The evaluator chooses every play and is shared by the threads
+RolloutResult rollout(const GameState& state, Evaluator& evaluator, const RolloutOptions& options)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // Each quasi-random ply goes through the 36 rolls in its own order so the plies are not correlated
+    std::vector<int> shuffleStorage(36 * (options.quasiRandomPlies > 0 ? options.quasiRandomPlies : 1));
+    int (*shuffles)[36] = reinterpret_cast<int (*)[36]>(shuffleStorage.data());
+    Xoshiro256 shuffleRng(options.seed);
+    for (int ply = 0; ply < options.quasiRandomPlies; ply++)
+    {
+        for (int i = 0; i < 36; i++)
+            shuffles[ply][i] = i;
+        std::shuffle(shuffles[ply], shuffles[ply] + 36, shuffleRng);
+    }
+
+    // Threads take blocks of 36 trials, so every block covers each first roll once
+    const long BLOCK = 36;
+    std::atomic<long> nextTrial(0);
+    std::atomic<bool> done(false);
+    std::mutex totalsLock;
+    RolloutTotals totals;
+
+    std::vector<std::thread> workers;
+    for (int id = 0; id < options.threads; id++)
+        workers.emplace_back([&]()
+        {
+            RandomDice dice;
+            while (!done.load(std::memory_order_relaxed))
+            {
+                long first = nextTrial.fetch_add(BLOCK);
+                if (first >= options.trials)
+                    break;
+                long last = std::min(first + BLOCK, options.trials);
+                RolloutTotals block;
+                for (long trial = first; trial < last; trial++)
+                {
+                    // Every trial has its own random stream so results do not depend on the number of threads 
+                    dice.rng.seed(Xoshiro256::streamSeed(options.seed, (uint64_t)trial));
+                    rolloutTrial(state, trial, evaluator, options, shuffles, dice, block);
+                }
+
+                std::lock_guard<std::mutex> guard(totalsLock);
+                totals.add(block);
+                if (options.targetError > 0 && totals.trials >= options.minTrials)
+                {
+                    double mean = totals.equity / totals.trials;
+                    double variance = totals.equitySquared / totals.trials - mean * mean;
+                    if (std::sqrt(std::max(variance, 0.0) / totals.trials) <= options.targetError)
+                        done = true;
+                }
+            }
+        });
+    for (std::thread& worker : workers)
+        worker.join();
+
+    RolloutResult result;
+    result.trials = totals.trials;
+    if (totals.trials > 0)
+    {
+        double trials = (double)totals.trials;
+        result.win = totals.win / trials;
+        result.winGammon = totals.winGammon / trials;
+        result.winBackgammon = totals.winBackgammon / trials;
+        result.loseGammon = totals.loseGammon / trials;
+        result.loseBackgammon = totals.loseBackgammon / trials;
+        result.equity = totals.equity / trials;
+        result.rawEquity = totals.rawEquity / trials;
+        double variance = totals.equitySquared / trials - result.equity * result.equity;
+        result.standardError = std::sqrt(std::max(variance, 0.0) / trials);
+    }
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+// Finds the play for a roll in a one-sided bearoff position that leaves the fewest rolls needed on average,
+// using the averages already worked out in "means" for positions with fewer pips
+void bestBearoffPlay(int8_t pieces[], const int rollDice[], int numDice, int depth, const std::vector<float>& means, float& bestMean, int& bestIndex)
+{
+    bool moved = false;
+    if (depth < numDice)
+    {
+        int highest = BearoffDatabase::POINTS;
+        while (highest > 0 && pieces[highest - 1] == 0)
+            highest--;
+        for (int point = highest; point > 0; point--)
+        {
+            // A piece can move inside the home quadrant, bear off exactly, or bear off with a higher dice from the highest point
+            int to = point - rollDice[depth];
+            if (pieces[point - 1] == 0 || (to < 0 && point != highest))
+                continue;
+            pieces[point - 1]--;
+            if (to > 0)
+                pieces[to - 1]++;
+            bestBearoffPlay(pieces, rollDice, numDice, depth + 1, means, bestMean, bestIndex);
+            if (to > 0)
+                pieces[to - 1]--;
+            pieces[point - 1]++;
+            moved = true;
+        }
+    }
+    if (!moved)
+    {
+        int index = BearoffDatabase::index(pieces);
+        if (means[index] < bestMean)
+        {
+            bestMean = means[index];
+            bestIndex = index;
+        }
+    }
+}
+
+// Builds the one-sided bearoff database. Positions are solved in order of pip count, since every play leads to a
+// position with fewer pips, and each roll's best play is the one leaving the fewest rolls needed on average
+bool BearoffDatabase::generate(const std::string& path)
+{
+    // List every position with its pip count 
+    struct Entry
+    {
+        int8_t pieces[POINTS];
+        int pips;
+    };
+    std::vector<Entry> entries;
+    Entry entry;
+    for (int a = 0; a <= NUM_PIECES; a++)
+        for (int b = 0; a + b <= NUM_PIECES; b++)
+            for (int c = 0; a + b + c <= NUM_PIECES; c++)
+                for (int d = 0; a + b + c + d <= NUM_PIECES; d++)
+                    for (int e = 0; a + b + c + d + e <= NUM_PIECES; e++)
+                        for (int f = 0; a + b + c + d + e + f <= NUM_PIECES; f++)
+                        {
+                            int8_t pieces[POINTS] = { (int8_t)a, (int8_t)b, (int8_t)c, (int8_t)d, (int8_t)e, (int8_t)f };
+                            std::memcpy(entry.pieces, pieces, sizeof(pieces));
+                            entry.pips = a + 2 * b + 3 * c + 4 * d + 5 * e + 6 * f;
+                            entries.push_back(entry);
+                        }
+    std::stable_sort(entries.begin(), entries.end(), [](const Entry& x, const Entry& y) { return x.pips < y.pips; });
+
+    std::vector<float> means(POSITIONS, 0.0f);
+    std::vector<double> chances((size_t)POSITIONS * MAX_ROLLS, 0.0);
+    chances[0] = 1.0;
+
+    for (Entry& position : entries)
+    {
+        int index = BearoffDatabase::index(position.pieces);
+        if (index == 0)
+            continue;
+        double mean = 1;
+        for (int roll = 0; roll < 21; roll++)
+        {
+            int rollDice[4];
+            int numDice = ROLLS.moves(roll, rollDice);
+            float bestMean = 1e9f;
+            int bestIndex = 0;
+            bestBearoffPlay(position.pieces, rollDice, numDice, 0, means, bestMean, bestIndex);
+            if (numDice == 2)
+            {
+                std::swap(rollDice[0], rollDice[1]);
+                bestBearoffPlay(position.pieces, rollDice, numDice, 0, means, bestMean, bestIndex);
+            }
+
+            // Bearing off takes this roll plus whatever the position after the best play needs, anything past
+            // the last bucket is counted in it
+            double probability = ROLLS.probability[roll];
+            mean += probability * means[bestIndex];
+            for (int rolls = 0; rolls < MAX_ROLLS; rolls++)
+                chances[(size_t)index * MAX_ROLLS + std::min(rolls + 1, MAX_ROLLS - 1)] += probability * chances[(size_t)bestIndex * MAX_ROLLS + rolls];
+        }
+        means[index] = (float)mean;
+    }
+
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    uint32_t header[4] = { 0, 1, POSITIONS, MAX_ROLLS };
+    std::memcpy(header, "BGBO", 4);
+    std::vector<uint16_t> packed(chances.size());
+    for (size_t i = 0; i < chances.size(); i++)
+        packed[i] = (uint16_t)std::lround(std::min(chances[i], 1.0) * 65535);
+    bool written = std::fwrite(header, sizeof(header), 1, file) == 1 &&
+        std::fwrite(means.data(), sizeof(float), means.size(), file) == means.size() &&
+        std::fwrite(packed.data(), sizeof(uint16_t), packed.size(), file) == packed.size();
+    return std::fclose(file) == 0 && written;
+}
+
+// Writes the book, placing the entries with a minimal perfect hash. The largest buckets are placed first, while
+// most places are still free, each trying displacements until all of its entries land in distinct free places
+bool OpeningBook::write(const std::string& path, const std::vector<Entry>& entries)
+{
+    uint32_t count = (uint32_t)entries.size();
+    uint32_t buckets = count / 4 + 1;
+    std::vector<uint64_t> hashes(count);
+    std::vector<std::vector<uint32_t>> members(buckets);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        PositionKey key;
+        std::memcpy(key.data, entries[i].key, sizeof(key.data));
+        hashes[i] = keyHash(key, entries[i].roll);
+        members[bucket(hashes[i], buckets)].push_back(i);
+    }
+    std::vector<uint32_t> order(buckets);
+    for (uint32_t b = 0; b < buckets; b++)
+        order[b] = b;
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t x, uint32_t y) { return members[x].size() > members[y].size(); });
+
+    std::vector<uint32_t> displacements(buckets, 0);
+    std::vector<Entry> table(count);
+    std::vector<bool> used(count, false);
+    std::vector<uint32_t> places;
+    for (uint32_t b : order)
+    {
+        if (members[b].empty())
+            break;
+        for (uint32_t displacement = 0; ; displacement++)
+        {
+            // Entries with the same key and roll would never land apart
+            if (displacement == (1u << 24))
+                return false;
+            places.clear();
+            for (uint32_t i : members[b])
+            {
+                uint32_t place = slot(hashes[i], displacement, count);
+                if (used[place] || std::find(places.begin(), places.end(), place) != places.end())
+                    break;
+                places.push_back(place);
+            }
+            if (places.size() == members[b].size())
+            {
+                displacements[b] = displacement;
+                for (size_t k = 0; k < places.size(); k++)
                 {
-                    Message += "\n~ has no valid moves, voiding turn, diceOne: " + std::to_string(dice.diceNums[0]) + " diceTwo: " + std::to_string(dice.diceNums[1]);
-                    dice.diceNums.clear();
-                    return;
+                    used[places[k]] = true;
+                    table[places[k]] = entries[members[b][k]];
+                }
+                break;
+            }
+        }
+    }
+
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    uint32_t header[4] = { 0, 1, count, buckets };
+    std::memcpy(header, "BGOB", 4);
+    bool written = std::fwrite(header, sizeof(header), 1, file) == 1 &&
+        std::fwrite(displacements.data(), sizeof(uint32_t), buckets, file) == buckets &&
+        std::fwrite(table.data(), sizeof(Entry), count, file) == count;
+    return std::fclose(file) == 0 && written;
+}
+
+// Builds the opening book from the starting position, one ply at a time. For every roll in every position of the
+// ply the plays are scored one ply deep, the best few are rolled out and the play with the best rollout equity goes
+// in the book. The positions after the book plays, with the other player to roll, make up the next ply
+bool OpeningBook::generate(const std::string& path, int plies, long trials, int threads)
+{
+    const int CANDIDATES = 3;
+    HeuristicEvaluator heuristic;
+    NeuralEvaluator neural(neuralNetwork);
+    RaceEvaluator race(neuralNetwork.loaded ? (Evaluator&)neural : heuristic);
+    BearoffEvaluator evaluator(bearoffDatabase, race);
+    RolloutOptions options;
+    options.trials = trials;
+    options.threads = threads;
+
+    std::vector<Entry> entries;
+    std::vector<GameState> positions(1);
+    initGame(positions[0]);
+    PositionKey startKey = positions[0].positionKey();
+    std::unordered_set<std::string> seen = { std::string((const char*)startKey.data, sizeof(startKey.data)) };
+    std::unique_ptr<PlayList> plays(new PlayList);
+    std::vector<float> values(MAX_PLAYS);
+    std::vector<int> order;
+    for (int ply = 0; ply < plies; ply++)
+    {
+        std::vector<GameState> next;
+        for (GameState& state : positions)
+            for (int roll = 0; roll < 21; roll++)
+            {
+                state.dice.setDice(ROLLS.dice[roll][0], ROLLS.dice[roll][1]);
+                state.generatePlays(*plays);
+                if (plays->maxMoves == 0)
+                    continue;
+
+                evaluator.evaluatePlays(state, *plays, values.data());
+                order.resize(plays->count);
+                for (int i = 0; i < plays->count; i++)
+                    order[i] = i;
+                std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return values[a] > values[b]; });
+
+                int best = order[0];
+                double bestEquity = -1e9;
+                for (int c = 0; c < std::min(CANDIDATES, plays->count); c++)
+                {
+                    GameState child = state;
+                    child.dice.clear();
+                    child.applyPlay(plays->plays[order[c]]);
+                    double equity;
+                    if (isGameOver(child))
+                        equity = getWinPoints(child);
+                    else
+                    {
+                        child.switchPlayer();
+                        equity = -rollout(child, evaluator, options).equity;
+                    }
+                    if (equity > bestEquity)
+                    {
+                        bestEquity = equity;
+                        best = order[c];
+                    }
                 }
-                else if (board[dice.diceNums[1] - 1] <= -2)
+
+                const Play& play = plays->plays[best];
+                Entry entry = {};
+                PositionKey key = state.positionKey();
+                std::memcpy(entry.key, key.data, sizeof(entry.key));
+                entry.roll = (uint8_t)roll;
+                entry.numMoves = (uint8_t)play.numMoves;
+                for (int i = 0; i < play.numMoves; i++)
                 {
-                    Message += "\n~ has no valid moves, voiding turn, diceOne: " + std::to_string(dice.diceNums[0]) + " diceTwo: " + std::to_string(dice.diceNums[1]);
-                    dice.diceNums.clear();
-                    return;
+                    int from = play.moves[i].from;
+                    int point = from == -1 ? 25 : (state.currentPlayer == Player::WHITE ? from + 1 : BOARD_SIZE - from);
+                    entry.moves[i] = (uint8_t)(point | (play.dice[i] << 5));
                 }
-                else
+                entries.push_back(entry);
+
+                GameState child = state;
+                child.dice.clear();
+                child.applyPlay(play);
+                if (!isGameOver(child))
                 {
-                    dice.swap();
-                    return;
+                    child.switchPlayer();
+                    PositionKey childKey = child.positionKey();
+                    if (seen.insert(std::string((const char*)childKey.data, sizeof(childKey.data))).second)
+                        next.push_back(child);
                 }
+                std::cout << "\rPly " << ply + 1 << ": " << entries.size() << " entries" << std::flush;
+            }
+        positions.swap(next);
+    }
+    std::cout << std::endl;
+    return write(path, entries);
+}
+
+bool MatchEquityTable::open(const std::string& path)
+{
+    if (map(path))
+        return true;
+    std::vector<float> values(ENTRIES);
+    compute(values.data(), values.data() + (MAX_AWAY + 1) * (MAX_AWAY + 1));
+
+    // Written to a temporary file first so that another process never maps a table that is half written
+    std::string temporary = path + ".tmp";
+    FILE* out = std::fopen(temporary.c_str(), "wb");
+    if (out)
+    {
+        uint32_t header[4] = { 0, 1, MAX_AWAY, 0 };
+        std::memcpy(header, "BGMT", 4);
+        float shares[2] = { GAMMON_SHARE, BACKGAMMON_SHARE };
+        bool written = std::fwrite(header, sizeof(header), 1, out) == 1 && std::fwrite(shares, sizeof(shares), 1, out) == 1 &&
+            std::fwrite(values.data(), sizeof(float), values.size(), out) == values.size();
+        if (std::fclose(out) == 0 && written && std::rename(temporary.c_str(), path.c_str()) == 0 && map(path))
+            return true;
+        std::remove(temporary.c_str());
+    }
+    memory = values;
+    pre = memory.data();
+    post = pre + (MAX_AWAY + 1) * (MAX_AWAY + 1);
+    return false;
+}
+
+// Maps the table file, returns false if it is missing or was made for other settings
+bool MatchEquityTable::map(const std::string& path)
+{
+    if (!file.open(path))
+        return false;
+    const uint8_t* data = file.data();
+    uint32_t header[4];
+    float shares[2];
+    if (file.size() != HEADER_SIZE + ENTRIES * sizeof(float) || std::memcmp(data, "BGMT", 4) != 0)
+    {
+        file.close();
+        return false;
+    }
+    std::memcpy(header, data, sizeof(header));
+    std::memcpy(shares, data + sizeof(header), sizeof(shares));
+    if (header[1] != 1 || header[2] != MAX_AWAY || shares[0] != GAMMON_SHARE || shares[1] != BACKGAMMON_SHARE)
+    {
+        file.close();
+        return false;
+    }
+    pre = reinterpret_cast<const float*>(data + HEADER_SIZE);
+    post = pre + (MAX_AWAY + 1) * (MAX_AWAY + 1);
+    return true;
+}
+
+// Fills the tables from the end of the match back. After the Crawford game the trailer doubles at once, so every
+// game is worth two points (four for a gammon) to the trailer and any win is enough for the leader. In the Crawford
+// game nobody doubles, and before it every game is counted at a cube of one
+void MatchEquityTable::compute(float pre[], float post[])
+{
+    const int SIZE = MAX_AWAY + 1;
+    const float results[3] = { 1 - GAMMON_SHARE, GAMMON_SHARE - BACKGAMMON_SHARE, BACKGAMMON_SHARE };
+    auto postAt = [&](int away) { return away <= 0 ? 1.0f : post[away]; };
+    post[0] = 1;
+    for (int away = 1; away < SIZE; away++)
+    {
+        post[away] = away == 1 ? 0.5f : 0;
+        for (int points = 1; points <= 3 && away > 1; points++)
+            post[away] += 0.5f * results[points - 1] * postAt(away - 2 * points);
+    }
+
+    // The trailer's chance in the Crawford game, where the leader is one point away
+    auto crawford = [&](int away)
+    {
+        float equity = 0;
+        for (int points = 1; points <= 3; points++)
+            equity += 0.5f * results[points - 1] * postAt(away - points);
+        return equity;
+    };
+    auto at = [&](int away, int oppAway) { return away <= 0 ? 1.0f : oppAway <= 0 ? 0.0f : pre[away * SIZE + oppAway]; };
+    for (int i = 0; i < SIZE; i++)
+        pre[i] = pre[i * SIZE] = 0;
+
+    // Every entry only needs entries with fewer points left in total
+    for (int total = 2; total <= 2 * MAX_AWAY; total++)
+        for (int away = std::max(1, total - MAX_AWAY); away <= std::min(MAX_AWAY, total - 1); away++)
+        {
+            int oppAway = total - away;
+            float& equity = pre[away * SIZE + oppAway];
+            if (away == 1 && oppAway == 1)
+                equity = 0.5f;
+            else if (oppAway == 1)
+                equity = crawford(away);
+            else if (away == 1)
+                equity = 1 - crawford(oppAway);
+            else
+            {
+                equity = 0;
+                for (int points = 1; points <= 3; points++)
+                    equity += 0.5f * results[points - 1] * (at(away - points, oppAway) + at(away, oppAway - points));
             }
-            return;
         }
+}
+
+// Trains the network by TD(lambda) self-play on several threads at once, saving it every checkpointGames games
+// (to a temporary file that then replaces the old one) and showing games/sec and positions/sec
+void trainNetwork(NeuralNetwork& network, const TrainOptions& options)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::atomic<long> nextGame(0);
+    std::atomic<long> gamesDone(0);
+    std::atomic<long> positions(0);
+    std::mutex saveLock;
 
-        // If the player has no barred pieces but can't move any of their pieces (excluding bearing off) 
-        if (currentPlayer == Player::WHITE && !canBearOff())
+    // Saves the weights and shows progress, one thread at a time 
+    auto checkpoint = [&](long games)
+    {
+        std::lock_guard<std::mutex> guard(saveLock);
+        std::string temporary = options.path + ".tmp";
+        bool saved = network.save(temporary) && std::rename(temporary.c_str(), options.path.c_str()) == 0;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cout << "Games: " << games << "  Games/sec: " << games / seconds << "  Positions/sec: " << positions.load() / seconds
+            << (saved ? "  saved " : "  could not save ") << options.path << std::endl;
+    };
+
+    std::vector<std::thread> workers;
+    for (int id = 0; id < options.threads; id++)
+        workers.emplace_back([&]()
         {
-            // Find all points player can move from 
-            std::vector<int> froms;
-            for (int i = 0; i < BOARD_SIZE; i++)
-                if (board[i] < 0)
-                    froms.push_back(i);
-            // For the points that the player can move from 
-            for (int i : froms)
+            TDLearner learner(network, options.alpha, options.lambda);
+            NeuralEvaluator evaluator(network);
+            EvaluatorPolicy policy(evaluator);
+            std::unique_ptr<PlayList> plays(new PlayList);
+            RandomDice dice;
+            GameState state;
+
+            for (long game = nextGame++; game < options.games; game = nextGame++)
             {
-                // If moving from point "i" using dice one is out of range of the board continue
-                if (i - dice.diceNums[0] < 0)
-                    continue;
-                // Else check to see if point from "i" using dice one is not occupied by more than one of an opponent's pieces 
-                else
-                    if (board[i - dice.diceNums[0]] < 2)
+                dice.rng.seed(Xoshiro256::streamSeed(options.seed, (uint64_t)game));
+                initGame(state);
+                learner.startGame();
+                long plies = 0;
+                while (!isGameOver(state))
+                {
+                    learner.observe(state.sideBoard(), state.currentPlayer == Player::WHITE);
+                    state.dice.clear();
+                    state.dice.rollDice(dice);
+                    state.generatePlays(*plays);
+                    state.applyPlay(plays->plays[plays->count > 1 ? policy.choosePlay(state, *plays) : 0]);
+                    if (!isGameOver(state))
+                        state.switchPlayer();
+                    plies++;
+                }
+
+                // The result as seen by WHITE 
+                int points = getWinPoints(state);
+                bool whiteWon = getWinner(state) == Player::WHITE;
+                float result[NeuralNetwork::OUTPUTS] = {
+                    whiteWon ? 1.0f : 0.0f,
+                    whiteWon && points >= 2 ? 1.0f : 0.0f,
+                    whiteWon && points == 3 ? 1.0f : 0.0f,
+                    !whiteWon && points >= 2 ? 1.0f : 0.0f,
+                    !whiteWon && points == 3 ? 1.0f : 0.0f };
+                learner.finish(result);
+
+                positions += plies;
+                long done = ++gamesDone;
+                if (options.checkpointGames > 0 && done % options.checkpointGames == 0 && done < options.games)
+                    checkpoint(done);
+            }
+        });
+    for (std::thread& worker : workers)
+        worker.join();
+    checkpoint(gamesDone.load());
+}
+
+// Times one benchmark over the positions of a category, "work" makes the calls for one position and returns a value for
+// the checksum. Passes are repeated, twice as many at a time, until "seconds" have passed
+template <typename Work>
+BenchResult benchPositions(const std::string& name, const std::string& category, std::vector<GameState>& positions, int callsPerPosition, double seconds, Work work)
+{
+    BenchResult result;
+    result.name = name;
+    result.category = category;
+    auto start = std::chrono::steady_clock::now();
+    long passes = 0;
+    for (long batch = 1; result.seconds < seconds; batch *= 2)
+    {
+        for (long pass = 0; pass < batch; pass++)
+        {
+            uint64_t sum = 0;
+            for (GameState& state : positions)
+                sum += work(state);
+            if (passes + pass == 0)
+                result.checksum = sum;
+        }
+        passes += batch;
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    result.calls = passes * (long)positions.size() * callsPerPosition;
+    return result;
+}
+
+// Runs the rules engine benchmarks on the corpus and whole games, and prints the results as JSON
+std::vector<BenchResult> runBenchmarks(const BenchOptions& options)
+{
+    // Group the corpus by category, keeping the order of the table 
+    std::vector<std::pair<std::string, std::vector<GameState>>> categories;
+    for (const BenchPosition& position : BENCH_CORPUS)
+    {
+        GameState state;
+        initGame(state);
+        state.currentPlayer = Player::WHITE;
+        if (!state.setPositionID(position.positionID))
+        {
+            std::cerr << "Bad corpus position " << position.positionID << std::endl;
+            continue;
+        }
+        if (categories.empty() || categories.back().first != position.category)
+            categories.push_back({ position.category, {} });
+        categories.back().second.push_back(state);
+    }
+
+    std::vector<BenchResult> results;
+    static thread_local PlayList plays;
+    for (auto& category : categories)
+    {
+        // Every move from every point (and the bar) with every die, legal or not 
+        results.push_back(benchPositions("validateMove", category.first, category.second, 6 * 25, options.seconds, [](GameState& state)
+            {
+                uint64_t sum = 0;
+                for (int die = 1; die <= 6; die++)
+                    for (int from = -1; from < BOARD_SIZE; from++)
+                    {
+                        int to = (from == -1 ? BOARD_SIZE : from) - die;
+                        Move move = { from, to < 0 ? 24 : to };
+                        sum += (uint64_t)state.validateMove(move, die);
+                    }
+                return sum;
+            }));
+
+        results.push_back(benchPositions("adjustDice", category.first, category.second, 21, options.seconds, [](GameState& state)
+            {
+                uint64_t sum = 0;
+                for (int roll = 0; roll < 21; roll++)
+                {
+                    state.dice.setDice(ROLLS.dice[roll][0], ROLLS.dice[roll][1]);
+                    sum += state.adjustDice() ? state.dice.diceNums[0] : 7;
+                }
+                state.dice.clear();
+                return sum;
+            }));
+
+        // The same rolls as adjustDice, positions and rolls are packed into the lanes in order and a batch is
+        // evaluated every time it fills up
+        static LegalityBatch batch;
+        int lane = 0;
+        results.push_back(benchPositions("legalityBatch", category.first, category.second, 21, options.seconds, [&lane](GameState& state)
+            {
+                uint64_t sum = 0;
+                SideBoard side = state.sideBoard();
+                for (int roll = 0; roll < 21; roll++)
+                {
+                    batch.set(lane++, side, ROLLS.dice[roll][0], ROLLS.dice[roll][1]);
+                    if (lane == LegalityBatch::LANES)
+                    {
+                        batch.evaluate();
+                        for (lane = 0; lane < LegalityBatch::LANES; lane++)
+                            sum += batch.anyMove(lane) ? batch.destinations[0][lane] : 7;
+                        lane = 0;
+                    }
+                }
+                return sum;
+            }));
+
+        results.push_back(benchPositions("canBearOff", category.first, category.second, 1, options.seconds, [](GameState& state)
+            {
+                return (uint64_t)state.canBearOff();
+            }));
+
+        results.push_back(benchPositions("generatePlays", category.first, category.second, 21, options.seconds, [](GameState& state)
+            {
+                uint64_t sum = 0;
+                for (int roll = 0; roll < 21; roll++)
+                {
+                    int rollDice[4];
+                    int numDice = ROLLS.moves(roll, rollDice);
+                    sum += state.generatePlays(rollDice, numDice, plays);
+                }
+                return sum;
+            }));
+    }
+
+    // Whole games from the start on one thread, the same seeds every run 
+    for (const char* name : { "random", "greedy" })
+    {
+        std::unique_ptr<PlayerPolicy> white = makePolicy(name);
+        std::unique_ptr<PlayerPolicy> black = makePolicy(name);
+        RandomDice dice;
+        BenchResult result;
+        result.name = "headlessGame";
+        result.category = name;
+        auto start = std::chrono::steady_clock::now();
+        for (long game = 0; game < options.games; game++)
+        {
+            GameState state;
+            startSeededGame(state, dice, *white, *black, options.seed, game);
+            int plies = playHeadlessGame(state, *white, *black, dice);
+            result.checksum += (uint64_t)plies * 4 + getWinPoints(state);
+        }
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.calls = options.games;
+        results.push_back(result);
+    }
+
+    // Display results, the build is included so that results from different builds can be told apart
+#if defined(__AVX2__) && defined(__FMA__)
+    const char* simd = "avx2";
+#elif defined(__SSE2__)
+    const char* simd = "sse2";
+#else
+    const char* simd = "scalar";
+#endif
+#ifdef __VERSION__
+    const char* compiler = __VERSION__;
+#else
+    const char* compiler = "unknown";
+#endif
+#ifdef ENABLE_METRICS
+    const char* metrics = "true";
+#else
+    const char* metrics = "false";
+#endif
+    std::cout << "{\n  \"compiler\": \"" << compiler << "\",\n  \"simd\": \"" << simd << "\",\n  \"metrics\": " << metrics << ",\n";
+    std::cout << "  \"corpus\": " << sizeof(BENCH_CORPUS) / sizeof(BENCH_CORPUS[0]) << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult& result = results[i];
+        double nanoseconds = result.calls > 0 ? result.seconds * 1e9 / result.calls : 0.0;
+        std::cout << "    { \"name\": \"" << result.name << "\", \"category\": \"" << result.category << "\", \"calls\": " << result.calls
+            << ", \"seconds\": " << result.seconds << ", \"nsPerCall\": " << nanoseconds << ", \"checksum\": " << result.checksum << " }"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    std::cout << "  ]\n}" << std::endl;
+    return results;
+}
+
+// Returns the same position with the colours swapped, each side's pieces go to the other side's matching points
+GameState mirrorPosition(const GameState& state)
+{
+    GameState mirror = state;
+    for (int i = 0; i < BOARD_SIZE; i++)
+        mirror.board[i] = -state.board[BOARD_SIZE - 1 - i];
+    mirror.whiteBar = state.blackBar;
+    mirror.blackBar = state.whiteBar;
+    mirror.whiteGoal = state.blackGoal;
+    mirror.blackGoal = state.whiteGoal;
+    mirror.currentPlayer = state.currentPlayer == Player::WHITE ? Player::BLACK : Player::WHITE;
+    mirror.rehash();
+    return mirror;
+}
+
+// Adds a value to a digest of the self-test results (FNV-1a over 64 bit words)
+uint64_t mixDigest(uint64_t digest, uint64_t value)
+{
+    return (digest ^ value) * 0x100000001B3ULL;
+}
+
+// Makes every play on state and returns the resulting positions, each as a hash of the packed key seen by the player
+// who made it, with the index of the play. The list is sorted so the order the plays were generated in does not matter.
+// Every move must pass validateMove with its die and undoPlay must give back the position, failures are counted
+std::vector<std::pair<uint64_t, int>> playResults(GameState& state, const PlayList& plays, long& failures)
+{
+    std::vector<std::pair<uint64_t, int>> results;
+    for (int i = 0; i < plays.count; i++)
+    {
+        const Play& play = plays.plays[i];
+        GameState before = state;
+        MoveUndo undo[4];
+        for (int m = 0; m < play.numMoves; m++)
+        {
+            if (state.validateMove(play.moves[m], play.dice[m]) != MoveError::NONE)
+                failures++;
+            undo[m] = state.applyMove(play.moves[m]);
+        }
+        PositionKey key = state.positionKey();
+        uint64_t hash = 0xCBF29CE484222325ULL;
+        for (uint8_t byte : key.data)
+            hash = mixDigest(hash, byte);
+        results.push_back({ hash, i });
+        state.undoPlay(undo, play.numMoves);
+        if (state.hash != before.hash || !(state.positionKey() == before.positionKey()))
+            failures++;
+    }
+    std::sort(results.begin(), results.end());
+    return results;
+}
+
+// Plays seeded selfplay games between the random and greedy policies and plays each of them again, first from the same
+// seed, then with the dice of the record dealt by ScriptedDice and last with ScriptedPolicy making the recorded plays
+// for both sides. Returns the number of replays whose record differs
+long checkReplays(long games, uint64_t seed)
+{
+    static PlayList plays;
+    std::unique_ptr<PlayerPolicy> white = makePolicy("random");
+    std::unique_ptr<PlayerPolicy> black = makePolicy("greedy");
+    ScriptedPolicy scripts[2];
+    GameState state;
+    RandomDice dice;
+    GameRecord record;
+    GameRecord replayed;
+    record.seed = replayed.seed = seed;
+    long failures = 0;
+    for (long game = 0; game < games; game++)
+    {
+        record.game = replayed.game = (uint32_t)game;
+        startSeededGame(state, dice, *white, *black, seed, game);
+        playHeadlessGame(state, *white, *black, dice, &record);
+        startSeededGame(state, dice, *white, *black, seed, game);
+        playHeadlessGame(state, *white, *black, dice, &replayed);
+        if (replayed.bytes != record.bytes)
+            failures++;
+
+        // The dice of every ply in the order they were rolled, and each side's plays where it had a choice (the policies
+        // are not asked otherwise)
+        GameRecordView view;
+        view.data = record.bytes.data();
+        view.size = (uint32_t)record.bytes.size();
+        GameRecordReplay replay;
+        std::vector<int> rolled;
+        for (ScriptedPolicy& script : scripts)
+            script.script.clear();
+        if (replay.start(view))
+            while (replay.next())
+            {
+                rolled.push_back(replay.dieOne);
+                rolled.push_back(replay.dieTwo);
+                replay.state.generatePlays(plays);
+                if (plays.count > 1)
+                {
+                    const Play& play = replay.play;
+                    scripts[replay.state.currentPlayer == Player::WHITE ? 0 : 1].script.push_back(std::vector<Move>(play.moves, play.moves + play.numMoves));
+                }
+            }
+        if (rolled.empty())
+        {
+            failures++;
+            continue;
+        }
+        ScriptedDice scripted(rolled);
+        startSeededGame(state, dice, *white, *black, seed, game);
+        playHeadlessGame(state, *white, *black, scripted, &replayed);
+        if (replayed.bytes != record.bytes)
+            failures++;
+
+        ScriptedDice scriptedAgain(rolled);
+        startSeededGame(state, dice, scripts[0], scripts[1], seed, game);
+        playHeadlessGame(state, scripts[0], scripts[1], scriptedAgain, &replayed);
+        if (replayed.bytes != record.bytes)
+            failures++;
+    }
+    return failures;
+}
+
+// Checks the rules on every position of seeded random games: validateMove and generatePlays must give the same
+// results for the position with the colours swapped, every move of a generated play must be valid and undoPlay must
+// take the play back. A run with the default games and seed must also match SELFTEST_DIGEST. The same games and seed
+// are then played as a selfplay batch, and every game must come out the same when it is played again
+bool runSelfTest(long games, uint64_t seed)
+{
+    static PlayList plays;
+    static PlayList mirrorPlays;
+    long positions = 0;
+    long failures = 0;
+    uint64_t digest = 0xCBF29CE484222325ULL;
+    for (long game = 0; game < games; game++)
+    {
+        Xoshiro256 rng(seed, (uint64_t)game);
+        GameState state;
+        initGame(state);
+        if (game & 1)
+        {
+            state.currentPlayer = Player::BLACK;
+            state.rehash();
+        }
+        while (!isGameOver(state))
+        {
+            positions++;
+            GameState mirror = mirrorPosition(state);
+
+            // Every move from every point (and the bar) to every point (and off) with every die, legal or not
+            for (int from = -1; from < BOARD_SIZE; from++)
+                for (int to = 0; to <= BOARD_SIZE; to++)
+                    for (int die = 1; die <= 6; die++)
+                    {
+                        MoveError error = state.validateMove({ from, to }, die);
+                        Move mirrored = { from == -1 ? -1 : BOARD_SIZE - 1 - from, to == BOARD_SIZE ? BOARD_SIZE : BOARD_SIZE - 1 - to };
+                        if (mirror.validateMove(mirrored, die) != error)
+                            failures++;
+                        digest = mixDigest(digest, (uint64_t)error);
+                    }
+
+            // Every roll, the mirrored position must have the same plays leading to the same positions
+            for (int roll = 0; roll < 21; roll++)
+            {
+                int rollDice[4];
+                int numDice = ROLLS.moves(roll, rollDice);
+                state.generatePlays(rollDice, numDice, plays);
+                mirror.generatePlays(rollDice, numDice, mirrorPlays);
+                std::vector<std::pair<uint64_t, int>> results = playResults(state, plays, failures);
+                std::vector<std::pair<uint64_t, int>> mirrorResults = playResults(mirror, mirrorPlays, failures);
+                if (plays.maxMoves != mirrorPlays.maxMoves || results.size() != mirrorResults.size())
+                    failures++;
+                for (size_t i = 0; i < results.size() && i < mirrorResults.size(); i++)
+                    if (results[i].first != mirrorResults[i].first)
+                        failures++;
+                for (int die = 1; die <= 6; die++)
+                    if (plays.firstDie[die] != mirrorPlays.firstDie[die])
+                        failures++;
+                digest = mixDigest(digest, (uint64_t)plays.maxMoves);
+                for (int die = 1; die <= 6; die++)
+                    digest = mixDigest(digest, (uint64_t)plays.firstDie[die]);
+                for (const std::pair<uint64_t, int>& result : results)
+                    digest = mixDigest(digest, result.first);
+            }
+
+            // Play on with a random roll and a random play, picked from the sorted results so it does not depend on
+            // the order of the plays either
+            int rollDice[4];
+            int dieOne = (int)rng.below(6) + 1;
+            int dieTwo = (int)rng.below(6) + 1;
+            rollDice[0] = rollDice[2] = rollDice[3] = dieOne;
+            rollDice[1] = dieTwo;
+            state.generatePlays(rollDice, dieOne == dieTwo ? 4 : 2, plays);
+            std::vector<std::pair<uint64_t, int>> results = playResults(state, plays, failures);
+            if (!results.empty())
+                state.applyPlay(plays.plays[results[rng.below((uint32_t)results.size())].second]);
+            if (!isGameOver(state))
+                state.switchPlayer();
+        }
+    }
+
+    long replayFailures = checkReplays(games, seed);
+    failures += replayFailures;
+    std::cout << "Positions: " << positions << "  Replays: " << games << " (" << replayFailures << " different)  Failures: " << failures
+        << "  Digest: " << std::hex << digest << std::dec << std::endl;
+    if (games == SELFTEST_GAMES && seed == SELFTEST_SEED && digest != SELFTEST_DIGEST)
+    {
+        std::cout << "Digest does not match the recorded " << std::hex << SELFTEST_DIGEST << std::dec << ", the rules have changed" << std::endl;
+        return false;
+    }
+    return failures == 0;
+}
+
+// Reads the next line of a file without its line ending, returns false at the end of the file
+bool readLine(FILE* file, std::string& line)
+{
+    line.clear();
+    char buffer[256];
+    while (std::fgets(buffer, sizeof(buffer), file))
+    {
+        line += buffer;
+        if (line.back() == '\n')
+        {
+            line.pop_back();
+            return true;
+        }
+    }
+    return !line.empty();
+}
+
+// Analyses one input line, "<position id> <die> <die>" with the position seen by the player on roll. The output line
+// has the position ID, the roll and then every play best first with its equity, all separated by tabs. The book
+// play is marked "(book)" when the position is in the opening book
+std::string analyzePosition(const std::string& line, SearchEngine& engine, TranspositionTable& table, int depth)
+{
+    static thread_local PlayList plays;
+    static thread_local float values[MAX_PLAYS];
+    static thread_local int order[MAX_PLAYS];
+
+    std::istringstream fields(line);
+    std::string id;
+    int dieOne = 0;
+    int dieTwo = 0;
+    fields >> id >> dieOne >> dieTwo;
+    if (!fields || dieOne < 1 || dieOne > 6 || dieTwo < 1 || dieTwo > 6)
+        return line + "\tERR expected <position id> <die> <die>";
+    GameState state;
+    initGame(state);
+    if (!state.setPositionID(id))
+        return line + "\tERR invalid position ID";
+    if (isGameOver(state))
+        return line + "\tERR the game is over";
+    state.dice.setDice(dieOne, dieTwo);
+    state.generatePlays(plays);
+
+    // Stored results are dropped so that a position gets the same values whichever worker analysed what before it.
+    // A one ply search never reaches the table
+    if (depth > 1)
+        table.newSearch();
+    engine.evaluatePlays(state, plays, depth, values);
+    for (int i = 0; i < plays.count; i++)
+        order[i] = i;
+    std::stable_sort(order, order + plays.count, [](int a, int b) { return values[a] > values[b]; });
+    int book = openingBook.find(state, plays);
+
+    std::string text = id + "\t" + std::to_string(dieOne) + std::to_string(dieTwo);
+    for (int i = 0; i < plays.count; i++)
+    {
+        const Play& play = plays.plays[order[i]];
+        char equity[16];
+        std::snprintf(equity, sizeof(equity), "%+.4f", values[order[i]] + 0.0f);
+        text += "\t" + (play.numMoves > 0 ? notationText(state, play) : std::string("no move"));
+        if (order[i] == book)
+            text += " (book)";
+        text += "\t";
+        text += equity;
+    }
+    return text;
+}
+
+// Analyses every position of the input on a pool of threads and writes the results in input order. The input is
+// read a line at a time and reading waits while options.window positions are in flight, so memory stays the same
+// however long the input is. Returns the number of positions, or -1 if the input could not be opened
+long analyzePositions(const AnalysisOptions& options, std::ostream& out)
+{
+    FILE* input = options.inputPath.empty() ? stdin : std::fopen(options.inputPath.c_str(), "r");
+    if (!input)
+        return -1;
+    long window = options.window > 0 ? options.window : 64L * options.threads;
+
+    // Lines waiting for a worker, and finished lines kept by their place in the input until the writer gets to them
+    std::mutex lock;
+    std::condition_variable workReady;
+    std::condition_variable resultReady;
+    std::condition_variable slotFree;
+    std::deque<std::pair<long, std::string>> queue;
+    std::vector<std::string> results(window);
+    std::vector<char> done(window, 0);
+    long nextRead = 0;
+    long nextWrite = 0;
+    bool finished = false;
+
+    std::vector<std::thread> workers;
+    for (int id = 0; id < options.threads; id++)
+        workers.emplace_back([&]()
+        {
+            // Every worker has its own evaluators, search and transposition table
+            SearchPolicy policy(options.depth, 0, false, 16);
+            for (;;)
+            {
+                std::pair<long, std::string> job;
+                {
+                    std::unique_lock<std::mutex> guard(lock);
+                    workReady.wait(guard, [&]() { return !queue.empty() || finished; });
+                    if (queue.empty())
                         return;
+                    job = std::move(queue.front());
+                    queue.pop_front();
+                }
+                std::string result = analyzePosition(job.second, policy.engine, policy.table, options.depth);
+                std::lock_guard<std::mutex> guard(lock);
+                results[job.first % window] = std::move(result);
+                done[job.first % window] = 1;
+                if (job.first == nextWrite)
+                    resultReady.notify_one();
             }
+        });
 
-            // If we didn't return that means there are no valid moves using dice one
-            // If there is only one dice or the dice is doubles->
-            if (dice.diceNums.size() == 1 || dice.diceNums.size() > 2)
+    // The writer prints finished lines in order and only flushes when it has to wait for the next one
+    std::thread writer([&]()
+    {
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;)
+        {
+            if (!done[nextWrite % window])
             {
-                Message += "\n~ has no valid moves, voiding turn, diceOne: " + std::to_string(dice.diceNums[0]) + " diceTwo: " + std::to_string(dice.diceNums[1]);
-                dice.diceNums.clear();
-                return;
+                if (finished && nextWrite == nextRead)
+                    return;
+                guard.unlock();
+                out.flush();
+                guard.lock();
+                resultReady.wait(guard, [&]() { return done[nextWrite % window] || (finished && nextWrite == nextRead); });
+                continue;
             }
-            // If there is more than one dice check if there are valid moves using dice two, if there is, swap() the player will have to use dice two first  
-            for (int i : froms)
+            std::string line = std::move(results[nextWrite % window]);
+            done[nextWrite % window] = 0;
+            nextWrite++;
+            slotFree.notify_one();
+            guard.unlock();
+            out << line << '\n';
+            guard.lock();
+        }
+    });
+
+    // Blank lines and lines starting with # are skipped
+    std::string line;
+    while (readLine(input, line))
+    {
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#')
+            continue;
+        line = line.substr(first, line.find_last_not_of(" \t\r") + 1 - first);
+        std::unique_lock<std::mutex> guard(lock);
+        slotFree.wait(guard, [&]() { return nextRead - nextWrite < window; });
+        queue.emplace_back(nextRead++, std::move(line));
+        workReady.notify_one();
+    }
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        finished = true;
+    }
+    workReady.notify_all();
+    resultReady.notify_one();
+    for (std::thread& worker : workers)
+        worker.join();
+    writer.join();
+    out.flush();
+    if (input != stdin)
+        std::fclose(input);
+    return nextRead;
+}
+
+// Returns the name of a side as used in the server protocol
+const char* sideName(Player player)
+{
+    return player == Player::WHITE ? "WHITE" : "BLACK";
+}
+
+#ifdef HAVE_EPOLL
+GameServer::GameServer(int workerCount, uint64_t seed)
+    : seed(seed)
+{
+    wakeFd = eventfd(0, EFD_NONBLOCK);
+    for (int i = 0; i < workerCount; i++)
+        workers.emplace_back([this, i]() { workerLoop(i); });
+}
+
+GameServer::~GameServer()
+{
+    {
+        std::lock_guard<std::mutex> guard(jobLock);
+        stopping = true;
+    }
+    jobReady.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+    for (auto& entry : connections)
+        ::close(entry.first);
+    if (listenFd >= 0)
+        ::close(listenFd);
+    if (epollFd >= 0)
+        ::close(epollFd);
+    if (wakeFd >= 0)
+        ::close(wakeFd);
+}
+
+bool GameServer::run(int port)
+{
+    listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listenFd < 0)
+        return false;
+    int on = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons((uint16_t)port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, SOMAXCONN) != 0)
+        return false;
+
+    epollFd = epoll_create1(0);
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = listenFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+    event.data.fd = wakeFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+    std::cout << "Serving games on 127.0.0.1:" << port << " with " << workers.size() << " bot workers" << std::endl;
+
+    epoll_event events[256];
+    auto lastReport = std::chrono::steady_clock::now();
+    long lastMoves = 0;
+    while (true)
+    {
+        int count = epoll_wait(epollFd, events, 256, 1000);
+        if (count < 0 && errno != EINTR)
+            return false;
+        for (int i = 0; i < count; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == listenFd)
+                acceptClients();
+            else if (fd == wakeFd)
+                finishBotTurns();
+            else
             {
-                // If moving from point "i" using dice two is out of range of the board continue
-                if (i - dice.diceNums[1] < 0)
+                auto found = connections.find(fd);
+                if (found == connections.end() || found->second->closing)
                     continue;
-                // Else check to see if point from "i" using dice two is not occupied by more than one of an opponent's pieces 
-                else
-                    if (board[i - dice.diceNums[1]] < 2)
-                    {
-                        dice.swap();
-                        return;
-                    }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                    readClient(*found->second);
+                if (events[i].events & EPOLLOUT)
+                    flush(*found->second);
+            }
+        }
+
+        // Send what the events produced, one write per connection, then drop the connections that have gone.
+        // Closing a connection can send to the other player of its game, so both lists are worked off together
+        while (!dirty.empty() || !pendingClose.empty())
+        {
+            std::vector<int> flushing;
+            flushing.swap(dirty);
+            for (int fd : flushing)
+            {
+                auto found = connections.find(fd);
+                if (found != connections.end() && !found->second->closing)
+                    flush(*found->second);
             }
-            // If we didn't return that means there are no valid moves using dice one or dice two 
-            Message += "\n~ has no valid moves, voiding turn, diceOne: " + std::to_string(dice.diceNums[0]) + " diceTwo: " + std::to_string(dice.diceNums[1]);
-            dice.diceNums.clear();
+            std::vector<int> closing;
+            closing.swap(pendingClose);
+            for (int fd : closing)
+                closeClient(fd);
+        }
+
+        // Display results now and then while there are games going on 
+        auto now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - lastReport).count();
+        if (seconds >= 10)
+        {
+            if (moves != lastMoves)
+                std::cout << "Connections: " << connections.size() << "  Games: " << games.size() << "  Moves/sec: " << (moves - lastMoves) / seconds << std::endl;
+            lastReport = now;
+            lastMoves = moves;
+        }
+    }
+}
+
+// Accepts every waiting client
+void GameServer::acceptClients()
+{
+    while (true)
+    {
+        int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK);
+        if (fd < 0)
             return;
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+        std::unique_ptr<ServerConnection> connection(new ServerConnection);
+        connection->fd = fd;
+        connections[fd] = std::move(connection);
+    }
+}
+
+// Reads what the client has sent and handles every complete line
+void GameServer::readClient(ServerConnection& connection)
+{
+    char buffer[4096];
+    bool gone = false;
+    while (true)
+    {
+        ssize_t received = recv(connection.fd, buffer, sizeof(buffer), 0);
+        if (received > 0)
+            connection.input.append(buffer, (size_t)received);
+        else if (received < 0 && errno == EINTR)
+            continue;
+        else
+        {
+            gone = received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+            break;
         }
-        // If the player has no barred pieces but can't move any of their pieces (BLACK)
-        if (currentPlayer == Player::BLACK && !canBearOff())
+    }
+
+    size_t start = 0;
+    size_t end;
+    while (!connection.closing && (end = connection.input.find('\n', start)) != std::string::npos)
+    {
+        std::string line = connection.input.substr(start, end - start);
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        start = end + 1;
+        handleCommand(connection, line);
+    }
+    connection.input.erase(0, start);
+
+    // A line longer than any command means the client is not speaking the protocol
+    if (gone || connection.input.size() > 1024)
+        markClosing(connection);
+}
+
+void GameServer::handleCommand(ServerConnection& connection, const std::string& line)
+{
+    std::istringstream words(line);
+    std::string command;
+    words >> command;
+    if (command == "NEW")
+    {
+        std::string side, opponent;
+        words >> side >> opponent;
+        newGame(connection, side, opponent);
+    }
+    else if (command == "JOIN")
+    {
+        int id;
+        if (words >> id)
+            joinGame(connection, id);
+        else
+            send(connection, "ERR usage: JOIN <game>");
+    }
+    else if (command == "MOVE")
+    {
+        int from, to;
+        if (words >> from >> to)
+            moveChecker(connection, from, to);
+        else
+            send(connection, "ERR usage: MOVE <from> <to>");
+    }
+    else if (command == "STATE")
+    {
+        auto found = games.find(connection.game);
+        if (found != games.end())
+            send(connection, stateText(*found->second));
+        else
+            send(connection, "ERR not in a game");
+    }
+    else if (command == "QUIT")
+        leaveGame(connection);
+    else if (command == "METRICS")
+    {
+#ifdef ENABLE_METRICS
+        std::ostringstream text;
+        writeMetricsPrometheus(text, Metrics::snapshot());
+        std::string lines = text.str();
+        send(connection, "METRICS " + std::to_string(std::count(lines.begin(), lines.end(), '\n')));
+        lines.pop_back();
+        send(connection, lines);
+#else
+        send(connection, "ERR metrics are not compiled in");
+#endif
+    }
+    else if (!command.empty())
+        send(connection, "ERR unknown command " + command);
+}
+
+// Queues a line for the client, it is sent once the current events have been handled
+void GameServer::send(ServerConnection& connection, const std::string& text)
+{
+    if (connection.closing)
+        return;
+    if (connection.output.empty() && !connection.writing)
+        dirty.push_back(connection.fd);
+    connection.output += text;
+    connection.output += '\n';
+}
+
+// Sends as much of the queued output as the socket takes, waiting for EPOLLOUT for the rest
+void GameServer::flush(ServerConnection& connection)
+{
+    size_t sent = 0;
+    while (sent < connection.output.size())
+    {
+        ssize_t written = ::send(connection.fd, connection.output.data() + sent, connection.output.size() - sent, MSG_NOSIGNAL);
+        if (written > 0)
+            sent += (size_t)written;
+        else if (written < 0 && errno == EINTR)
+            continue;
+        else if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        else
         {
-            std::vector<int> froms;
-            for (int i = 0; i < BOARD_SIZE; i++)
-                if (board[i] > 0)
-                    froms.push_back(i);
-            for (int i : froms)
-            {
-                if (i + dice.diceNums[0] > 23)
-                    continue;
-                else
-                    if (board[i + dice.diceNums[0]] > -2)
-                        return;
-            }
-            if (dice.diceNums.size() == 1)
-            {
-                Message += "\n~ has no valid moves, voiding turn, diceOne: " + std::to_string(dice.diceNums[0]) + " diceTwo: " + std::to_string(dice.diceNums[1]);
-                dice.diceNums.clear();
-                return;
-            }
-            for (int i : froms)
-            {
-                if (i + dice.diceNums[0] > 23)
-                    continue;
-                else
-                    if (board[i + dice.diceNums[0]] > -2)
-                    {
-                        dice.swap();
-                        return;
-                    }
-            }
-            Message += "\n~ has no valid moves, voiding turn, diceOne: " + std::to_string(dice.diceNums[0]) + " diceTwo: " + std::to_string(dice.diceNums[1]);
-            dice.diceNums.clear();
+            markClosing(connection);
             return;
         }
+    }
+    connection.output.erase(0, sent);
+
+    // A client that stops reading is dropped before its output takes up too much memory
+    if (connection.output.size() > (1 << 20))
+    {
+        markClosing(connection);
         return;
     }
-};
+    bool waiting = !connection.output.empty();
+    if (waiting != connection.writing)
+    {
+        epoll_event event = {};
+        event.events = (uint32_t)EPOLLIN | (waiting ? (uint32_t)EPOLLOUT : 0u);
+        event.data.fd = connection.fd;
+        epoll_ctl(epollFd, EPOLL_CTL_MOD, connection.fd, &event);
+        connection.writing = waiting;
+    }
+}
 
-//function prototypes
-void initGame(GameState& state);
-void printBoard(const GameState& state);
-void playGame(GameState& state);
-bool isGameOver(const GameState& state);
-Player getWinner(const GameState& state);
+void GameServer::markClosing(ServerConnection& connection)
+{
+    if (connection.closing)
+        return;
+    connection.closing = true;
+    pendingClose.push_back(connection.fd);
+}
 
-// Main function
-int main()
+void GameServer::closeClient(int fd)
 {
-    // Seed the random number generator
-    srand(time(NULL));
+    auto found = connections.find(fd);
+    if (found == connections.end())
+        return;
+    leaveGame(*found->second);
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    ::close(fd);
+    connections.erase(found);
+}
 
-    // Create the game state
-    GameState state;
-    initGame(state);
+void GameServer::newGame(ServerConnection& connection, const std::string& side, const std::string& opponent)
+{
+    if (side != "white" && side != "black")
+    {
+        send(connection, "ERR usage: NEW <white|black> <human|random|greedy|neural|search>");
+        return;
+    }
+    if (opponent != "human" && opponent != "random" && opponent != "greedy" && opponent != "neural" && opponent != "search")
+    {
+        send(connection, "ERR unknown opponent " + opponent + ", use human, random, greedy, neural or search");
+        return;
+    }
+    leaveGame(connection);
 
-    // Play the game
-    playGame(state);
+    std::unique_ptr<ServerGame> created(new ServerGame);
+    ServerGame& game = *created;
+    game.id = nextGame++;
+    initGame(game.state);
+    game.dice.rng.seed(Xoshiro256::streamSeed(seed, (uint64_t)game.id));
+    int own = side == "white" ? 0 : 1;
+    game.seats[own] = connection.fd;
+    if (opponent != "human")
+        game.bots[1 - own] = opponent;
+    games[game.id] = std::move(created);
 
-    return 0;
+    connection.game = game.id;
+    connection.side = own == 0 ? Player::WHITE : Player::BLACK;
+    send(connection, "JOINED " + std::to_string(game.id) + " " + sideName(connection.side));
+    startTurn(game);
 }
 
-// Initializes the game state
-void initGame(GameState& state)
+void GameServer::joinGame(ServerConnection& connection, int id)
 {
-    // Clear the board
-    for (int i = 0; i < BOARD_SIZE; i++)
-        state.board[i] = 0;
+    auto found = games.find(id);
+    if (found == games.end() || connection.game == id)
+    {
+        send(connection, "ERR cannot join game " + std::to_string(id));
+        return;
+    }
+    ServerGame& game = *found->second;
+    int side = -1;
+    for (int i = 0; i < 2; i++)
+        if (game.seats[i] == -1 && game.bots[i].empty())
+            side = i;
+    if (side == -1)
+    {
+        send(connection, "ERR game " + std::to_string(id) + " is full");
+        return;
+    }
+    leaveGame(connection);
+    game.seats[side] = connection.fd;
+    connection.game = id;
+    connection.side = side == 0 ? Player::WHITE : Player::BLACK;
+    send(connection, "JOINED " + std::to_string(id) + " " + sideName(connection.side));
+    send(connection, stateText(game));
+}
 
-    // Place the pieces on the board
-    state.board[0] = 2;
-    state.board[11] = 5;
-    state.board[16] = 3;
-    state.board[18] = 5;
+// Takes the client out of its game, a game nobody is connected to any more is dropped
+void GameServer::leaveGame(ServerConnection& connection)
+{
+    if (connection.game == -1)
+        return;
+    auto found = games.find(connection.game);
+    connection.game = -1;
+    if (found == games.end())
+        return;
+    ServerGame& game = *found->second;
+    int side = connection.side == Player::WHITE ? 0 : 1;
+    game.seats[side] = -1;
+    if (game.seats[1 - side] == -1)
+        games.erase(found);
+    else
+        broadcast(game, "LEFT " + std::to_string(game.id) + " " + sideName(connection.side));
+}
 
-    state.board[23] = -2;
-    state.board[12] = -5;
-    state.board[7] = -3;
-    state.board[5] = -5;
+// Makes a client's move if it is the start of one of the legal plays for the dice left, which also makes sure as many
+// dice as possible are used. Otherwise the client gets the same message as at the console
+void GameServer::moveChecker(ServerConnection& connection, int from, int to)
+{
+    auto found = games.find(connection.game);
+    if (found == games.end())
+    {
+        send(connection, "ERR not in a game");
+        return;
+    }
+    ServerGame& game = *found->second;
+    GameState& state = game.state;
+    if (state.currentPlayer != connection.side || state.dice.empty())
+    {
+        send(connection, "ERR not your turn");
+        return;
+    }
 
-    // Set the initial number of pieces on the bar and in the home quadrant
-    state.whiteBar = 0;
-    state.blackBar = 0;
-    state.whiteGoal = 0;
-    state.blackGoal = 0;
+    // Points are numbered as at the console, 0 is the bar and 25 is bearing off
+    Move move = { from - 1, to - 1 };
+    if (move.from < -1 || move.from > 23 || move.to < 0 || move.to > 24)
+    {
+        send(connection, "ERR points must be from 0 to 25");
+        return;
+    }
 
-    // Set the current player to white
-    state.currentPlayer = Player::WHITE;
+    // The plays keep one order of moves per resulting position, so a move is legal if it is allowed with one of the
+    // dice and the rest of the roll can then be played to a position some legal play leads to. The positions are kept
+    // sorted by their packed key so they can be looked up without hashing
+    static PlayList plays;
+    static PlayList rest;
+    static PositionKey results[MAX_PLAYS];
+    auto before = [](const PositionKey& a, const PositionKey& b) { return std::memcmp(a.data, b.data, sizeof(a.data)) < 0; };
+    state.generatePlays(plays);
+    GameState after = state;
+    for (int i = 0; i < plays.count; i++)
+    {
+        MoveUndo undo[4];
+        after.applyPlay(plays.plays[i], undo);
+        results[i] = after.positionKey();
+        after.undoPlay(undo, plays.plays[i].numMoves);
+    }
+    std::sort(results, results + plays.count, before);
+    auto reached = [&](const GameState& position) { return std::binary_search(results, results + plays.count, position.positionKey(), before); };
+
+    MoveError error = MoveError::NONE;
+    bool allowed = false;
+    for (int i = 0; i < state.dice.count; i++)
+    {
+        int die = state.dice.diceNums[i];
+        MoveError dieError = state.validateMove(move, die);
+        if (dieError != MoveError::NONE)
+        {
+            if (error == MoveError::NONE)
+                error = dieError;
+            continue;
+        }
+        allowed = true;
+        after = state;
+        if (after.dice.diceNums[0] != die)
+            after.dice.swap();
+        after.dice.useFirst();
+        after.applyMove(move);
+        bool legal = false;
+        if (after.dice.empty())
+            legal = reached(after);
+        else
+        {
+            after.generatePlays(rest);
+            for (int j = 0; j < rest.count && !legal; j++)
+            {
+                MoveUndo undo[4];
+                after.applyPlay(rest.plays[j], undo);
+                legal = rest.plays[j].numMoves == plays.maxMoves - 1 && reached(after);
+                after.undoPlay(undo, rest.plays[j].numMoves);
+            }
+        }
+        if (legal)
+        {
+            makeMove(game, move, die);
+            endMove(game);
+            return;
+        }
+    }
+
+    // A move is only reported as not allowed when no die allows it
+    if (allowed)
+        send(connection, std::string("ERR ") + sideName(state.currentPlayer) + " must move so that as many dice as possible are used");
+    else
+        send(connection, std::string("ERR ") + sideName(state.currentPlayer) + moveMessage(error, move));
 }
 
-// Prints the current board state
-void printBoard(const GameState& state)
+// Makes a legal move with the given die and tells both sides
+void GameServer::makeMove(ServerGame& game, const Move& move, int die)
 {
-    std::cout << "=====================================================" << std::endl;
+    GameState& state = game.state;
+    if (state.dice.diceNums[0] != die)
+        state.dice.swap();
+    state.dice.useFirst();
+    bool hit = state.applyMove(move).hit;
+    moves++;
+    broadcast(game, "MOVED " + std::to_string(game.id) + " " + sideName(state.currentPlayer) + " " + std::to_string(move.from + 1)
+        + " " + std::to_string(move.to + 1) + (hit ? " HIT" : ""));
+}
 
-    // Show current dice (moves) 
-    int id = 1;
-    for (int i : state.dice.diceNums)
+// Ends the game, lets the player move again or passes the turn after a move. The game may be gone afterwards
+void GameServer::endMove(ServerGame& game)
+{
+    GameState& state = game.state;
+    game.serial++;
+    if (isGameOver(state))
+    {
+        broadcast(game, "OVER " + std::to_string(game.id) + " " + sideName(getWinner(state)) + " " + std::to_string(getWinPoints(state)));
+        for (int fd : game.seats)
+        {
+            auto found = connections.find(fd);
+            if (found != connections.end())
+                found->second->game = -1;
+        }
+        games.erase(game.id);
+        return;
+    }
+    if (!state.dice.empty() && state.adjustDice())
     {
-        std::cout << "Dice " + std::to_string(id) + ": " << i << std::endl;
-        id++;
+        broadcast(game, stateText(game));
+        return;
     }
+    state.switchPlayer();
+    startTurn(game);
+}
 
-    std::string tempBoardTop = "";
-    std::string tempBoardBottom = "";
-    int count = 0;
+// Rolls for the player to move, passing the turn while the roll cannot be played, and hands the turn to a bot if needed
+void GameServer::startTurn(ServerGame& game)
+{
+    GameState& state = game.state;
+    while (true)
+    {
+        state.dice.clear();
+        state.dice.rollDice(game.dice);
+        int dieOne = state.dice.diceNums[0];
+        int dieTwo = state.dice.diceNums[1];
+        if (state.adjustDice())
+            break;
+        broadcast(game, "VOID " + std::to_string(game.id) + " " + sideName(state.currentPlayer) + " " + std::to_string(dieOne) + " " + std::to_string(dieTwo));
+        state.switchPlayer();
+    }
+    game.serial++;
+    broadcast(game, stateText(game));
 
-    for (int index = 12; index < BOARD_SIZE; index++)
+    const std::string& bot = game.bots[state.currentPlayer == Player::WHITE ? 0 : 1];
+    if (!bot.empty())
     {
-        if (count == 6)
         {
-            tempBoardTop.append("| | ");
-            tempBoardBottom.append("| | ");
+            std::lock_guard<std::mutex> guard(jobLock);
+            jobs.push_back({ game.id, game.serial, state, bot, Play() });
         }
-        tempBoardTop.append("(" + std::to_string(state.board[index]) + ") ");
-        tempBoardBottom.append("(" + std::to_string(state.board[23 - index]) + ") ");
-        count++;
+        jobReady.notify_one();
     }
+}
 
-    std::cout << "\n" << tempBoardTop << "\n\n" << std::endl;
-    std::cout << tempBoardBottom << "\n\n" << std::endl;
-    std::cout << "White Bar: " << state.whiteBar << std::endl;
-    std::cout << "Black Bar: " << state.blackBar << "\n\n";
+// Makes the plays the workers have chosen, unless the game has moved on or gone in the meantime
+void GameServer::finishBotTurns()
+{
+    uint64_t count;
+    if (read(wakeFd, &count, sizeof(count)) < 0)
+        return;
+    std::deque<BotJob> finished;
+    {
+        std::lock_guard<std::mutex> guard(jobLock);
+        finished.swap(done);
+    }
+    for (const BotJob& job : finished)
+    {
+        auto found = games.find(job.game);
+        if (found == games.end() || found->second->serial != job.serial)
+            continue;
+        ServerGame& game = *found->second;
+        for (int i = 0; i < job.play.numMoves; i++)
+            makeMove(game, job.play.moves[i], job.play.dice[i]);
+        endMove(game);
+    }
+}
 
-    if (state.whiteGoal || state.blackGoal)
+void GameServer::broadcast(ServerGame& game, const std::string& text)
+{
+    for (int fd : game.seats)
     {
-        std::cout << "White Goal: " << state.whiteGoal << std::endl;
-        std::cout << "Black Goal: " << state.blackGoal << "\n\n";
+        auto found = connections.find(fd);
+        if (found != connections.end())
+            send(*found->second, text);
     }
-    std::cout << "=====================================================" << std::endl;
 }
 
-// Plays a game of backgammon
-void playGame(GameState& state)
+// Returns the STATE line of a game, the position ID is seen by the player to move
+std::string GameServer::stateText(const ServerGame& game) const
 {
-    // Display general information
-    std::cout << "Welcome to the wonderful game of backgammon!\n1. from = 0 to move from bar\n2. to = 25 to bear off\n3. from = -2 to swap dice\n\n";
-    // While the game is not over keep switching players 
-    while (!isGameOver(state))
+    const GameState& state = game.state;
+    std::string text = "STATE " + std::to_string(game.id) + " " + sideName(state.currentPlayer) + " " + state.positionID();
+    for (int i = 0; i < state.dice.count; i++)
+        text += " " + std::to_string(state.dice.diceNums[i]);
+    return text;
+}
+
+// Chooses plays for bot sides, every worker has its own policies
+void GameServer::workerLoop(int index)
+{
+    std::unordered_map<std::string, std::unique_ptr<PlayerPolicy>> policies;
+    std::unique_ptr<PlayList> plays(new PlayList);
+    while (true)
     {
-        // Roll the dice 
-        state.dice.rollDice();
+        BotJob job;
+        {
+            std::unique_lock<std::mutex> guard(jobLock);
+            jobReady.wait(guard, [this]() { return stopping || !jobs.empty(); });
+            if (stopping)
+                return;
+            job = jobs.front();
+            jobs.pop_front();
+        }
 
-        // Check to make sure the player has possible moves 
-        state.adjustDice();
+        std::unique_ptr<PlayerPolicy>& policy = policies[job.policy];
+        if (!policy)
+        {
+            policy = makePolicy(job.policy);
+            policy->reset(Xoshiro256::streamSeed(seed, (uint64_t)index));
+        }
+        job.state.generatePlays(*plays);
+        job.play = plays->plays[plays->count > 1 ? policy->choosePlay(job.state, *plays) : 0];
 
-        // While there is still a move available and the game is not over 
-        while (state.dice.diceNums.size() > 0 && !isGameOver(state))
         {
-            // Print the board
-            printBoard(state);
+            std::lock_guard<std::mutex> guard(jobLock);
+            done.push_back(job);
+        }
+        uint64_t one = 1;
+        if (write(wakeFd, &one, sizeof(one)) < 0)
+            return;
+    }
+}
 
-            // Variables to hold players turn 
-            int from, to;
+// Connects many clients to a server, each playing game after game against a bot with random plays, and reports the
+// moves per second and how long the server took to answer each move
+void runLoadGenerator(const LoadOptions& options)
+{
+    std::mutex resultsLock;
+    std::vector<double> latencies;
+    long games = 0, errors = 0, failed = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::microseconds((long long)(options.seconds * 1e6));
 
-            // Get player's move, loop if the user's inputs are out of range, check if the player is swapping the dice or asking for general info 
-            do
+    std::vector<std::thread> threads;
+    for (int id = 0; id < options.threads; id++)
+        threads.emplace_back([&, id]()
+        {
+            std::vector<LoadClient> clients;
+            for (int i = id; i < options.clients; i += options.threads)
             {
-                std::cout << "~ from = -3 to view game information again" << std::endl;
-                std::cout << "Player " << (state.currentPlayer == Player::WHITE ? "White" : "Black") << ", enter your move (from point *enter*, to point *enter*): " << std::endl;
-                std::cin >> from >> to;
-                if (from == -2)
+                LoadClient client;
+                client.fd = socket(AF_INET, SOCK_STREAM, 0);
+                sockaddr_in address = {};
+                address.sin_family = AF_INET;
+                address.sin_port = htons((uint16_t)options.port);
+                address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+                if (client.fd < 0 || connect(client.fd, (sockaddr*)&address, sizeof(address)) != 0)
                 {
-                    state.dice.swap();
-                    std::cout << " Dice swapped please enter a move" << std::endl;
+                    if (client.fd >= 0)
+                        ::close(client.fd);
+                    std::lock_guard<std::mutex> guard(resultsLock);
+                    failed++;
+                    continue;
                 }
-                else if (from == -3)
-                    std::cout<< "1. from = 0 to move from bar\n2.to = 25 to bear off\n3.from = -2 to swap dice\nPlease enter a move\n\n";
-                from--;
-                to--;
-            } while (from < -1 || from > 23 || to < 0 || to > 25);
-
-            // Update current move 
-            state.currentMove.from = from;
-            state.currentMove.to = to;
+                int on = 1;
+                setsockopt(client.fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+                clients.push_back(client);
+            }
 
-            // If the move is valid, remove dice (move) from diceNums and check to make sure the player still has a valid move 
-            if (state.checkMove())
+            int epollFd = epoll_create1(0);
+            for (size_t i = 0; i < clients.size(); i++)
             {
-                state.dice.diceNums.erase(state.dice.diceNums.begin());
-                if (!state.dice.diceNums.empty())
-                    state.adjustDice();
+                epoll_event event = {};
+                event.events = EPOLLIN;
+                event.data.u64 = i;
+                epoll_ctl(epollFd, EPOLL_CTL_ADD, clients[i].fd, &event);
             }
+            auto sendText = [](LoadClient& client, const std::string& text)
+            {
+                return ::send(client.fd, text.data(), text.size(), MSG_NOSIGNAL) == (ssize_t)text.size();
+            };
+            std::string newGame = "NEW white " + options.opponent + "\n";
+            for (LoadClient& client : clients)
+                sendText(client, newGame);
 
-            // Display result of turn, clear message 
-            std::cout << "\n" << state.currentPlayer << state.Message << "\n\n";
-            state.Message.clear();
-        }
-        // Display result of turn if adjustDice found there is no available moves for player 
-        if (!state.Message.empty())
-            std::cout << state.currentPlayer << state.Message << "\n\n";
+            Xoshiro256 rng(Xoshiro256::streamSeed(options.seed, (uint64_t)id));
+            std::unique_ptr<PlayList> plays(new PlayList);
+            std::vector<double> threadLatencies;
+            long threadGames = 0, threadErrors = 0;
+            epoll_event events[64];
+            while (std::chrono::steady_clock::now() < deadline)
+            {
+                int count = epoll_wait(epollFd, events, 64, 100);
+                for (int e = 0; e < count; e++)
+                {
+                    LoadClient& client = clients[events[e].data.u64];
+                    char buffer[4096];
+                    ssize_t received = recv(client.fd, buffer, sizeof(buffer), 0);
+                    if (received <= 0)
+                    {
+                        epoll_ctl(epollFd, EPOLL_CTL_DEL, client.fd, nullptr);
+                        threadErrors++;
+                        continue;
+                    }
+                    client.input.append(buffer, (size_t)received);
 
-        // Switch players
-        state.currentPlayer = (state.currentPlayer == Player::WHITE ? Player::BLACK : Player::WHITE);
-    }
+                    size_t begin = 0;
+                    size_t end;
+                    while ((end = client.input.find('\n', begin)) != std::string::npos)
+                    {
+                        std::istringstream words(client.input.substr(begin, end - begin));
+                        begin = end + 1;
+                        std::string kind, side;
+                        int game;
+                        words >> kind >> game >> side;
+                        Player player = side == "WHITE" ? Player::WHITE : Player::BLACK;
+                        if (kind == "JOINED")
+                            client.side = player;
+                        else if (kind == "MOVED" && player == client.side && !client.sent.empty())
+                        {
+                            threadLatencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - client.sent.front()).count());
+                            client.sent.pop_front();
+                        }
+                        else if (kind == "ERR")
+                        {
+                            threadErrors++;
+                            if (!client.sent.empty())
+                                client.sent.pop_front();
+                            if (client.sent.empty())
+                                sendText(client, "STATE\n");
+                        }
+                        else if (kind == "OVER")
+                        {
+                            threadGames++;
+                            client.sent.clear();
+                            sendText(client, newGame);
+                        }
+                        else if (kind == "STATE" && player == client.side && client.sent.empty())
+                        {
+                            // Pick a random legal play and send all its moves at once 
+                            std::string position;
+                            words >> position;
+                            GameState state;
+                            state.currentPlayer = client.side;
+                            if (!state.setPositionID(position))
+                                continue;
+                            state.dice.count = 0;
+                            int die;
+                            while (state.dice.count < 4 && words >> die)
+                                state.dice.diceNums[state.dice.count++] = die;
+                            if (state.generatePlays(*plays) == 0)
+                                continue;
+                            const Play& play = plays->plays[rng.below((uint32_t)plays->count)];
+                            std::string text;
+                            for (int i = 0; i < play.numMoves; i++)
+                                text += "MOVE " + std::to_string(play.moves[i].from + 1) + " " + std::to_string(play.moves[i].to + 1) + "\n";
+                            auto now = std::chrono::steady_clock::now();
+                            for (int i = 0; i < play.numMoves; i++)
+                                client.sent.push_back(now);
+                            sendText(client, text);
+                        }
+                    }
+                    client.input.erase(0, begin);
+                }
+            }
+            for (LoadClient& client : clients)
+                ::close(client.fd);
+            ::close(epollFd);
 
-    // Print the board one last time
-    printBoard(state);
+            std::lock_guard<std::mutex> guard(resultsLock);
+            latencies.insert(latencies.end(), threadLatencies.begin(), threadLatencies.end());
+            games += threadGames;
+            errors += threadErrors;
+        });
+    for (std::thread& thread : threads)
+        thread.join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 
-    // Announce the winner
-    std::cout << "Player " << (getWinner(state) == Player::WHITE ? "White" : "Black") << " wins!" << std::endl;
+    // Display results
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) { return latencies.empty() ? 0.0 : latencies[std::min(latencies.size() - 1, (size_t)(p * latencies.size()))]; };
+    std::cout << "Clients: " << options.clients - failed << " connected, " << failed << " failed" << std::endl;
+    std::cout << "Games finished: " << games << "  Moves: " << latencies.size() << "  Moves/sec: " << latencies.size() / seconds << "  Errors: " << errors << std::endl;
+    std::cout << "Move latency (us): p50 " << percentile(0.5) << "  p90 " << percentile(0.9) << "  p99 " << percentile(0.99)
+        << "  max " << (latencies.empty() ? 0.0 : latencies.back()) << std::endl;
 }
+#endif
 
-// Returns true if the game is over, false otherwise
-bool isGameOver(const GameState& state)
+#ifdef ENABLE_METRICS
+// Writes a metrics snapshot as JSON: calls and latency buckets for every operation and the move checks by result
+void writeMetricsJSON(std::ostream& out, const MetricsSnapshot& metrics)
 {
-    return state.whiteGoal == NUM_PIECES || state.blackGoal == NUM_PIECES;
+    out << "{\n  \"operations\": [\n";
+    for (int m = 0; m < NUM_METRICS; m++)
+    {
+        out << "    { \"name\": \"" << METRIC_NAMES[m] << "\", \"calls\": " << metrics.calls[m];
+        if (METRIC_TIMED[m])
+        {
+            out << ", \"nanoseconds\": " << metrics.nanoseconds[m] << ", \"latencyBuckets\": [";
+            for (int b = 0; b < LATENCY_BUCKETS; b++)
+                out << (b ? ", " : "") << metrics.latency[m][b];
+            out << "]";
+        }
+        out << " }" << (m + 1 < NUM_METRICS ? "," : "") << "\n";
+    }
+    out << "  ],\n  \"moveChecks\": {";
+    for (int e = 0; e < NUM_MOVE_ERRORS; e++)
+        out << (e ? ", " : " ") << "\"" << MOVE_ERROR_NAMES[e] << "\": " << metrics.moveChecks[e];
+    out << " }\n}\n";
 }
 
-// Returns the winner of the game
-Player getWinner(const GameState& state)
+// Writes a metrics snapshot in the Prometheus text format, latencies as cumulative histograms in seconds
+void writeMetricsPrometheus(std::ostream& out, const MetricsSnapshot& metrics)
 {
-    return state.whiteGoal == NUM_PIECES ? Player::WHITE : Player::BLACK;
+    out << "# HELP runner_calls_total Calls of each instrumented operation of the rules engine.\n";
+    out << "# TYPE runner_calls_total counter\n";
+    for (int m = 0; m < NUM_METRICS; m++)
+        out << "runner_calls_total{operation=\"" << METRIC_NAMES[m] << "\"} " << metrics.calls[m] << "\n";
+
+    out << "# HELP runner_latency_seconds Time taken by each call of the timed operations.\n";
+    out << "# TYPE runner_latency_seconds histogram\n";
+    for (int m = 0; m < NUM_METRICS; m++)
+    {
+        if (!METRIC_TIMED[m])
+            continue;
+        uint64_t cumulative = 0;
+        for (int b = 0; b < LATENCY_BUCKETS - 1; b++)
+        {
+            cumulative += metrics.latency[m][b];
+            out << "runner_latency_seconds_bucket{operation=\"" << METRIC_NAMES[m] << "\",le=\"" << (double)(2ULL << b) * 1e-9 << "\"} " << cumulative << "\n";
+        }
+        out << "runner_latency_seconds_bucket{operation=\"" << METRIC_NAMES[m] << "\",le=\"+Inf\"} " << metrics.calls[m] << "\n";
+        out << "runner_latency_seconds_sum{operation=\"" << METRIC_NAMES[m] << "\"} " << metrics.nanoseconds[m] * 1e-9 << "\n";
+        out << "runner_latency_seconds_count{operation=\"" << METRIC_NAMES[m] << "\"} " << metrics.calls[m] << "\n";
+    }
+
+    out << "# HELP runner_move_checks_total Moves checked by validateMove, by result.\n";
+    out << "# TYPE runner_move_checks_total counter\n";
+    for (int e = 0; e < NUM_MOVE_ERRORS; e++)
+        out << "runner_move_checks_total{result=\"" << MOVE_ERROR_NAMES[e] << "\"} " << metrics.moveChecks[e] << "\n";
+}
+
+// Writes the metrics to the file named by RUNNER_METRICS when the program exits, as JSON if the name ends in .json
+void writeMetricsAtExit()
+{
+    std::string path = std::getenv("RUNNER_METRICS");
+    std::ostringstream text;
+    if (path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0)
+        writeMetricsJSON(text, Metrics::snapshot());
+    else
+        writeMetricsPrometheus(text, Metrics::snapshot());
+    FILE* file = std::fopen(path.c_str(), "w");
+    bool written = file && std::fputs(text.str().c_str(), file) >= 0;
+    if (!file || std::fclose(file) != 0 || !written)
+        std::cerr << "Could not write metrics to " << path << std::endl;
 }
+#endif